@@ -0,0 +1,189 @@
+#include <string.h>
+
+#include "chain_simd.h"
+#include "config.h"
+#include "utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#if MAX_PASSWD != 16
+#error "chain_simd_impl.h specializes password lengths 1..16 only"
+#endif
+
+// reductionMap widened to 32 bits, so that it can be gathered from
+static uint32_t reductionMap32[REDUCTION_TABLE_SIZE];
+
+// portable implementation, one chain at a time
+#define VEC                     uint32_t
+#define CHAIN_LANES             1
+#define CHAIN_FN                generateChainsScalar
+#define CHAIN_WALK_FN           walkChainsScalar
+#define CHAIN_TARGET
+#define VSET1(x)                ((uint32_t)(x))
+#define VLOAD(p)                (*(p))
+#define VSTORE(p, v)            (*(p) = (v))
+#define VADD(a, b)              ((a) + (b))
+#define VAND(a, b)              ((a) & (b))
+#define VOR(a, b)               ((a) | (b))
+#define VXOR(a, b)              ((a) ^ (b))
+#define VNOT(a)                 (~(a))
+#define VSHL(a, s)              ((a) << (s))
+#define VSHR(a, s)              ((a) >> (s))
+#define VROL(a, s)              (((a) << (s)) | ((a) >> (32 - (s))))
+#define VGATHER(idx)            (reductionMap32[idx])
+#include "chain_simd_impl.h"
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static inline __m128i gatherSse2(__m128i index)
+{
+    uint32_t i[4] __attribute__((aligned(16)));
+
+    _mm_store_si128((__m128i *)i, index);
+
+    return _mm_set_epi32(reductionMap32[i[3]], reductionMap32[i[2]],
+                         reductionMap32[i[1]], reductionMap32[i[0]]);
+}
+
+#define VEC                     __m128i
+#define CHAIN_LANES             4
+#define CHAIN_FN                generateChainsSse2
+#define CHAIN_WALK_FN           walkChainsSse2
+#define CHAIN_TARGET            __attribute__((target("sse2")))
+#define VSET1(x)                _mm_set1_epi32(x)
+#define VLOAD(p)                _mm_load_si128((const __m128i *)(p))
+#define VSTORE(p, v)            _mm_store_si128((__m128i *)(p), (v))
+#define VADD(a, b)              _mm_add_epi32((a), (b))
+#define VAND(a, b)              _mm_and_si128((a), (b))
+#define VOR(a, b)               _mm_or_si128((a), (b))
+#define VXOR(a, b)              _mm_xor_si128((a), (b))
+#define VNOT(a)                 _mm_xor_si128((a), _mm_set1_epi32(-1))
+#define VSHL(a, s)              _mm_slli_epi32((a), (s))
+#define VSHR(a, s)              _mm_srli_epi32((a), (s))
+#define VROL(a, s)              _mm_or_si128(_mm_slli_epi32((a), (s)), \
+                                             _mm_srli_epi32((a), 32 - (s)))
+#define VGATHER(idx)            gatherSse2(idx)
+#include "chain_simd_impl.h"
+
+#define VEC                     __m256i
+#define CHAIN_LANES             8
+#define CHAIN_FN                generateChainsAvx2
+#define CHAIN_WALK_FN           walkChainsAvx2
+#define CHAIN_TARGET            __attribute__((target("avx2")))
+#define VSET1(x)                _mm256_set1_epi32(x)
+#define VLOAD(p)                _mm256_load_si256((const __m256i *)(p))
+#define VSTORE(p, v)            _mm256_store_si256((__m256i *)(p), (v))
+#define VADD(a, b)              _mm256_add_epi32((a), (b))
+#define VAND(a, b)              _mm256_and_si256((a), (b))
+#define VOR(a, b)               _mm256_or_si256((a), (b))
+#define VXOR(a, b)              _mm256_xor_si256((a), (b))
+#define VNOT(a)                 _mm256_xor_si256((a), _mm256_set1_epi32(-1))
+#define VSHL(a, s)              _mm256_slli_epi32((a), (s))
+#define VSHR(a, s)              _mm256_srli_epi32((a), (s))
+#define VROL(a, s)              _mm256_or_si256(_mm256_slli_epi32((a), (s)), \
+                                               _mm256_srli_epi32((a), 32 - (s)))
+#define VGATHER(idx)            _mm256_i32gather_epi32( \
+                                    (const int *)reductionMap32, (idx), 4)
+#include "chain_simd_impl.h"
+
+#define VEC                     __m512i
+#define CHAIN_LANES             16
+#define CHAIN_FN                generateChainsAvx512
+#define CHAIN_WALK_FN           walkChainsAvx512
+#define CHAIN_TARGET            __attribute__((target("avx512f")))
+#define VSET1(x)                _mm512_set1_epi32(x)
+#define VLOAD(p)                _mm512_load_si512((const void *)(p))
+#define VSTORE(p, v)            _mm512_store_si512((void *)(p), (v))
+#define VADD(a, b)              _mm512_add_epi32((a), (b))
+#define VAND(a, b)              _mm512_and_si512((a), (b))
+#define VOR(a, b)               _mm512_or_si512((a), (b))
+#define VXOR(a, b)              _mm512_xor_si512((a), (b))
+#define VNOT(a)                 _mm512_xor_si512((a), _mm512_set1_epi32(-1))
+#define VSHL(a, s)              _mm512_slli_epi32((a), (s))
+#define VSHR(a, s)              _mm512_srli_epi32((a), (s))
+#define VROL(a, s)              _mm512_rol_epi32((a), (s))
+#define VGATHER(idx)            _mm512_i32gather_epi32((idx), \
+                                    (const void *)reductionMap32, 4)
+#include "chain_simd_impl.h"
+#endif
+
+static int supportedAlways(void)
+{
+    return 1;
+}
+
+#ifdef HAVE_X86_SIMD
+static int supportedSse2(void)
+{
+    return __builtin_cpu_supports("sse2");
+}
+
+static int supportedAvx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+static int supportedAvx512(void)
+{
+    return __builtin_cpu_supports("avx512f");
+}
+#endif
+
+static const struct {
+    struct chain_simd impl;
+    int (*supported)(void);
+} implementations[] = {
+#ifdef HAVE_X86_SIMD
+    { { "avx512", 16, generateChainsAvx512Table, walkChainsAvx512Table },
+      supportedAvx512 },
+    { { "avx2", 8, generateChainsAvx2Table, walkChainsAvx2Table },
+      supportedAvx2 },
+    { { "sse2", 4, generateChainsSse2Table, walkChainsSse2Table },
+      supportedSse2 },
+#endif
+    { { "scalar", 1, generateChainsScalarTable, walkChainsScalarTable },
+      supportedAlways },
+};
+
+#define NUM_IMPLEMENTATIONS \
+    (sizeof(implementations) / sizeof(implementations[0]))
+
+static void initReductionMap32(void)
+{
+    int i;
+
+    for (i = 0; i < REDUCTION_TABLE_SIZE; ++i)
+        reductionMap32[i] = (uint8_t)reductionMap[i];
+}
+
+const struct chain_simd *chainSimdSelect(void)
+{
+    unsigned int i;
+
+    initReductionMap32();
+
+    for (i = 0; i < NUM_IMPLEMENTATIONS; ++i) {
+        if (implementations[i].supported())
+            return &implementations[i].impl;
+    }
+
+    return NULL;
+}
+
+const struct chain_simd *chainSimdFind(const char *name)
+{
+    unsigned int i;
+
+    initReductionMap32();
+
+    for (i = 0; i < NUM_IMPLEMENTATIONS; ++i) {
+        if (!strcmp(implementations[i].impl.name, name))
+            return implementations[i].supported()
+                            ? &implementations[i].impl : NULL;
+    }
+
+    return NULL;
+}
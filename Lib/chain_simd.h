@@ -0,0 +1,34 @@
+#ifndef _CHAIN_SIMD_H
+#define _CHAIN_SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rainbow_chain.h"
+
+// fills in end-point hashes of count chains from their start passwords
+typedef void (*chain_simd_fn)(struct rainbow_chain *chains, size_t count,
+                              uint32_t chainLength);
+
+// follows chain links from count hashes: hash i is reduced with salt
+// firstSalts[i], hashed, and so on for steps[i] links; hashes of one
+// group of lanes should take similar numbers of steps
+typedef void (*chain_simd_walk_fn)(hash_t *hashes, const uint32_t *firstSalts,
+                                   const uint32_t *steps, size_t count);
+
+// chain generator walking several chains in lockstep, one per SIMD lane
+struct chain_simd {
+    const char *name;
+    unsigned int lanes;
+    // specialized for every password length, indexed by the length
+    const chain_simd_fn *generate;
+    const chain_simd_walk_fn *walk;
+};
+
+// returns the widest implementation supported by the CPU
+const struct chain_simd *chainSimdSelect(void);
+
+// returns implementation of given name or NULL if CPU does not support it
+const struct chain_simd *chainSimdFind(const char *name);
+
+#endif
@@ -0,0 +1,341 @@
+// Multi-buffer chain generator template, included by chain_simd.c once per
+// instruction set. The includer defines:
+//   VEC, CHAIN_LANES       vector type and number of 32-bit lanes in it
+//   CHAIN_FN, CHAIN_TARGET name and attributes of the generated function
+//   CHAIN_WALK_FN          name of the generated chain_simd_walk_fn
+//   VSET1, VLOAD, VSTORE, VADD, VAND, VOR, VXOR, VNOT, VSHL, VSHR, VROL
+//   VGATHER(idx)           reductionMap32 lookup of every lane
+
+#ifndef CHAIN_SIMD_MD5_STEPS
+#define CHAIN_SIMD_MD5_STEPS
+
+// The basic MD5 functions, same as in rainbow.cl
+#define VF(x, y, z)             VXOR((z), VAND((x), VXOR((y), (z))))
+#define VG(x, y, z)             VXOR((y), VAND((z), VXOR((x), (y))))
+#define VH(x, y, z)             VXOR(VXOR((x), (y)), (z))
+#define VI(x, y, z)             VXOR((y), VOR((x), VNOT(z)))
+
+#define VSTEP(f, a, b, c, d, x, t, s) \
+    (a) = VADD(VADD((a), f((b), (c), (d))), VADD((x), VSET1(t))); \
+    (a) = VADD(VROL((a), (s)), (b));
+
+// number of message words a password with its 0x80 terminator can touch
+#define CHAIN_MSG_WORDS         (MAX_PASSWD / 4 + 1)
+
+#define CHAIN_CONCAT_(a, b)     a##b
+#define CHAIN_CONCAT(a, b)      CHAIN_CONCAT_(a, b)
+
+#endif
+
+// MD5 of a password packed into message words, see md5_compress_folded()
+CHAIN_TARGET
+static inline __attribute__((always_inline))
+void CHAIN_CONCAT(CHAIN_FN, Md5)(const VEC *w, VEC len, VEC *outA, VEC *outB,
+                                 VEC *outC, VEC *outD)
+{
+    const VEC zero = VSET1(0);
+    VEC a, b, c, d;
+
+    a = VSET1(0x67452301);
+    b = VSET1(0xefcdab89);
+    c = VSET1(0x98badcfe);
+    d = VSET1(0x10325476);
+
+    // Round 1
+    VSTEP(VF, a, b, c, d, w[0], 0xd76aa478, 7)
+    VSTEP(VF, d, a, b, c, w[1], 0xe8c7b756, 12)
+    VSTEP(VF, c, d, a, b, w[2], 0x242070db, 17)
+    VSTEP(VF, b, c, d, a, w[3], 0xc1bdceee, 22)
+    VSTEP(VF, a, b, c, d, w[4], 0xf57c0faf, 7)
+    VSTEP(VF, d, a, b, c, zero, 0x4787c62a, 12)
+    VSTEP(VF, c, d, a, b, zero, 0xa8304613, 17)
+    VSTEP(VF, b, c, d, a, zero, 0xfd469501, 22)
+    VSTEP(VF, a, b, c, d, zero, 0x698098d8, 7)
+    VSTEP(VF, d, a, b, c, zero, 0x8b44f7af, 12)
+    VSTEP(VF, c, d, a, b, zero, 0xffff5bb1, 17)
+    VSTEP(VF, b, c, d, a, zero, 0x895cd7be, 22)
+    VSTEP(VF, a, b, c, d, zero, 0x6b901122, 7)
+    VSTEP(VF, d, a, b, c, zero, 0xfd987193, 12)
+    VSTEP(VF, c, d, a, b, len,  0xa679438e, 17)
+    VSTEP(VF, b, c, d, a, zero, 0x49b40821, 22)
+
+    // Round 2
+    VSTEP(VG, a, b, c, d, w[1], 0xf61e2562, 5)
+    VSTEP(VG, d, a, b, c, zero, 0xc040b340, 9)
+    VSTEP(VG, c, d, a, b, zero, 0x265e5a51, 14)
+    VSTEP(VG, b, c, d, a, w[0], 0xe9b6c7aa, 20)
+    VSTEP(VG, a, b, c, d, zero, 0xd62f105d, 5)
+    VSTEP(VG, d, a, b, c, zero, 0x02441453, 9)
+    VSTEP(VG, c, d, a, b, zero, 0xd8a1e681, 14)
+    VSTEP(VG, b, c, d, a, w[4], 0xe7d3fbc8, 20)
+    VSTEP(VG, a, b, c, d, zero, 0x21e1cde6, 5)
+    VSTEP(VG, d, a, b, c, len,  0xc33707d6, 9)
+    VSTEP(VG, c, d, a, b, w[3], 0xf4d50d87, 14)
+    VSTEP(VG, b, c, d, a, zero, 0x455a14ed, 20)
+    VSTEP(VG, a, b, c, d, zero, 0xa9e3e905, 5)
+    VSTEP(VG, d, a, b, c, w[2], 0xfcefa3f8, 9)
+    VSTEP(VG, c, d, a, b, zero, 0x676f02d9, 14)
+    VSTEP(VG, b, c, d, a, zero, 0x8d2a4c8a, 20)
+
+    // Round 3
+    VSTEP(VH, a, b, c, d, zero, 0xfffa3942, 4)
+    VSTEP(VH, d, a, b, c, zero, 0x8771f681, 11)
+    VSTEP(VH, c, d, a, b, zero, 0x6d9d6122, 16)
+    VSTEP(VH, b, c, d, a, len,  0xfde5380c, 23)
+    VSTEP(VH, a, b, c, d, w[1], 0xa4beea44, 4)
+    VSTEP(VH, d, a, b, c, w[4], 0x4bdecfa9, 11)
+    VSTEP(VH, c, d, a, b, zero, 0xf6bb4b60, 16)
+    VSTEP(VH, b, c, d, a, zero, 0xbebfbc70, 23)
+    VSTEP(VH, a, b, c, d, zero, 0x289b7ec6, 4)
+    VSTEP(VH, d, a, b, c, w[0], 0xeaa127fa, 11)
+    VSTEP(VH, c, d, a, b, w[3], 0xd4ef3085, 16)
+    VSTEP(VH, b, c, d, a, zero, 0x04881d05, 23)
+    VSTEP(VH, a, b, c, d, zero, 0xd9d4d039, 4)
+    VSTEP(VH, d, a, b, c, zero, 0xe6db99e5, 11)
+    VSTEP(VH, c, d, a, b, zero, 0x1fa27cf8, 16)
+    VSTEP(VH, b, c, d, a, w[2], 0xc4ac5665, 23)
+
+    // Round 4
+    VSTEP(VI, a, b, c, d, w[0], 0xf4292244, 6)
+    VSTEP(VI, d, a, b, c, zero, 0x432aff97, 10)
+    VSTEP(VI, c, d, a, b, len,  0xab9423a7, 15)
+    VSTEP(VI, b, c, d, a, zero, 0xfc93a039, 21)
+    VSTEP(VI, a, b, c, d, zero, 0x655b59c3, 6)
+    VSTEP(VI, d, a, b, c, w[3], 0x8f0ccc92, 10)
+    VSTEP(VI, c, d, a, b, zero, 0xffeff47d, 15)
+    VSTEP(VI, b, c, d, a, w[1], 0x85845dd1, 21)
+    VSTEP(VI, a, b, c, d, zero, 0x6fa87e4f, 6)
+    VSTEP(VI, d, a, b, c, zero, 0xfe2ce6e0, 10)
+    VSTEP(VI, c, d, a, b, zero, 0xa3014314, 15)
+    VSTEP(VI, b, c, d, a, zero, 0x4e0811a1, 21)
+    VSTEP(VI, a, b, c, d, w[4], 0xf7537e82, 6)
+    VSTEP(VI, d, a, b, c, zero, 0xbd3af235, 10)
+    VSTEP(VI, c, d, a, b, w[2], 0x2ad7d2bb, 15)
+    VSTEP(VI, b, c, d, a, zero, 0xeb86d391, 21)
+
+    *outA = VADD(a, VSET1(0x67452301));
+    *outB = VADD(b, VSET1(0xefcdab89));
+    *outC = VADD(c, VSET1(0x98badcfe));
+    *outD = VADD(d, VSET1(0x10325476));
+}
+
+// reduces a hash with salt of every lane back into message words, see
+// reduce()
+CHAIN_TARGET
+static inline __attribute__((always_inline))
+void CHAIN_CONCAT(CHAIN_FN, Reduce)(VEC *w, VEC a, VEC b, VEC c, VEC d,
+                                    VEC salt, uint32_t passwordLength)
+{
+    const VEC zero = VSET1(0);
+    const VEC terminator = VSET1(0x80U << ((passwordLength & 3) * 8));
+    const VEC mask = VSET1(REDUCTION_TABLE_SIZE - 1);
+    VEC words[(MAX_PASSWD + 2) / 3];
+    uint32_t p;
+
+    // see REDUCTION_WORD()
+    words[0] = VADD(a, salt);
+    words[1] = VADD(b, salt);
+    words[2] = VADD(c, salt);
+    words[3] = VADD(d, salt);
+    words[4] = VADD(VXOR(a, b), salt);
+    words[5] = VADD(VXOR(b, c), salt);
+
+    for (p = 0; p < CHAIN_MSG_WORDS; ++p)
+        w[p] = zero;
+
+    _Pragma("GCC unroll 16")
+    for (p = 0; p < passwordLength; ++p) {
+        VEC index = VAND(VSHR(words[p / 3], (p % 3) * 9), mask);
+
+        w[p >> 2] = VOR(w[p >> 2], VSHL(VGATHER(index), (p & 3) * 8));
+    }
+
+    w[passwordLength >> 2] = VOR(w[passwordLength >> 2], terminator);
+}
+
+// generic body, only ever inlined with a constant passwordLength
+CHAIN_TARGET
+static inline __attribute__((always_inline))
+void CHAIN_FN(struct rainbow_chain *chains, size_t count,
+              uint32_t passwordLength, uint32_t chainLength)
+{
+    uint32_t lanes[CHAIN_MSG_WORDS][CHAIN_LANES]
+                                __attribute__((aligned(64)));
+    const VEC len = VSET1(8 * passwordLength);
+    const VEC terminator = VSET1(0x80U << ((passwordLength & 3) * 8));
+    size_t base;
+
+    for (base = 0; base < count; base += CHAIN_LANES) {
+        VEC w[CHAIN_MSG_WORDS];
+        VEC a, b, c, d;
+        uint32_t i, p, l;
+
+        // pack start passwords into message words, padding the tail with
+        // copies of the last chain
+        memset(lanes, 0, sizeof(lanes));
+        for (l = 0; l < CHAIN_LANES; ++l) {
+            size_t index = base + l < count ? base + l : count - 1;
+            const char *password = chains[index].password;
+
+            for (p = 0; p < passwordLength; ++p)
+                lanes[p >> 2][l] |= (uint32_t)(uint8_t)password[p]
+                                                        << ((p & 3) * 8);
+        }
+
+        for (i = 0; i < CHAIN_MSG_WORDS; ++i)
+            w[i] = VLOAD(lanes[i]);
+        w[passwordLength >> 2] = VOR(w[passwordLength >> 2], terminator);
+
+        for (i = 0; ; ++i) {
+            CHAIN_CONCAT(CHAIN_FN, Md5)(w, len, &a, &b, &c, &d);
+
+            if (i == chainLength)
+                break;
+
+            CHAIN_CONCAT(CHAIN_FN, Reduce)(w, a, b, c, d, VSET1(i),
+                                           passwordLength);
+        }
+
+        VSTORE(lanes[0], a);
+        VSTORE(lanes[1], b);
+        VSTORE(lanes[2], c);
+        VSTORE(lanes[3], d);
+
+        for (l = 0; l < CHAIN_LANES && base + l < count; ++l) {
+            for (p = 0; p < 4; ++p)
+                chains[base + l].hash[p] = lanes[p][l];
+        }
+    }
+}
+
+// walks count chains from hashes, see chain_simd_walk_fn; lanes taking
+// fewer links than others of their group are stored when they finish
+CHAIN_TARGET
+static inline __attribute__((always_inline))
+void CHAIN_WALK_FN(hash_t *hashes, const uint32_t *firstSalts,
+                   const uint32_t *steps, size_t count,
+                   uint32_t passwordLength)
+{
+    uint32_t lanes[4][CHAIN_LANES] __attribute__((aligned(64)));
+    uint32_t salts[CHAIN_LANES] __attribute__((aligned(64)));
+    const VEC len = VSET1(8 * passwordLength);
+    const VEC one = VSET1(1);
+    size_t base;
+
+    for (base = 0; base < count; base += CHAIN_LANES) {
+        VEC w[CHAIN_MSG_WORDS];
+        VEC a, b, c, d, salt;
+        uint32_t maxSteps = 0;
+        uint32_t i, p, l;
+
+        // padding lanes repeat the last chain
+        for (l = 0; l < CHAIN_LANES; ++l) {
+            size_t index = base + l < count ? base + l : count - 1;
+
+            for (p = 0; p < 4; ++p)
+                lanes[p][l] = hashes[index][p];
+            salts[l] = firstSalts[index];
+            if (steps[index] > maxSteps)
+                maxSteps = steps[index];
+        }
+
+        a = VLOAD(lanes[0]);
+        b = VLOAD(lanes[1]);
+        c = VLOAD(lanes[2]);
+        d = VLOAD(lanes[3]);
+        salt = VLOAD(salts);
+
+        for (i = 1; i <= maxSteps; ++i) {
+            int done = 0;
+
+            CHAIN_CONCAT(CHAIN_FN, Reduce)(w, a, b, c, d, salt,
+                                           passwordLength);
+            CHAIN_CONCAT(CHAIN_FN, Md5)(w, len, &a, &b, &c, &d);
+            salt = VADD(salt, one);
+
+            for (l = 0; l < CHAIN_LANES && base + l < count; ++l)
+                done |= steps[base + l] == i;
+            if (!done)
+                continue;
+
+            VSTORE(lanes[0], a);
+            VSTORE(lanes[1], b);
+            VSTORE(lanes[2], c);
+            VSTORE(lanes[3], d);
+
+            for (l = 0; l < CHAIN_LANES && base + l < count; ++l) {
+                if (steps[base + l] != i)
+                    continue;
+                for (p = 0; p < 4; ++p)
+                    hashes[base + l][p] = lanes[p][l];
+            }
+        }
+    }
+}
+
+// one function per password length, see chainSimd tables in chain_simd.c
+#define CHAIN_SPECIALIZE(n) \
+    CHAIN_TARGET \
+    static void CHAIN_CONCAT(CHAIN_FN, n)(struct rainbow_chain *chains, \
+                                         size_t count, uint32_t chainLength) \
+    { \
+        CHAIN_FN(chains, count, n, chainLength); \
+    } \
+    CHAIN_TARGET \
+    static void CHAIN_CONCAT(CHAIN_WALK_FN, n)(hash_t *hashes, \
+                                              const uint32_t *firstSalts, \
+                                              const uint32_t *steps, \
+                                              size_t count) \
+    { \
+        CHAIN_WALK_FN(hashes, firstSalts, steps, count, n); \
+    }
+
+CHAIN_SPECIALIZE(1)  CHAIN_SPECIALIZE(2)  CHAIN_SPECIALIZE(3)
+CHAIN_SPECIALIZE(4)  CHAIN_SPECIALIZE(5)  CHAIN_SPECIALIZE(6)
+CHAIN_SPECIALIZE(7)  CHAIN_SPECIALIZE(8)  CHAIN_SPECIALIZE(9)
+CHAIN_SPECIALIZE(10) CHAIN_SPECIALIZE(11) CHAIN_SPECIALIZE(12)
+CHAIN_SPECIALIZE(13) CHAIN_SPECIALIZE(14) CHAIN_SPECIALIZE(15)
+CHAIN_SPECIALIZE(16)
+
+static const chain_simd_fn CHAIN_CONCAT(CHAIN_FN, Table)[MAX_PASSWD + 1] = {
+    NULL,
+    CHAIN_CONCAT(CHAIN_FN, 1),  CHAIN_CONCAT(CHAIN_FN, 2),
+    CHAIN_CONCAT(CHAIN_FN, 3),  CHAIN_CONCAT(CHAIN_FN, 4),
+    CHAIN_CONCAT(CHAIN_FN, 5),  CHAIN_CONCAT(CHAIN_FN, 6),
+    CHAIN_CONCAT(CHAIN_FN, 7),  CHAIN_CONCAT(CHAIN_FN, 8),
+    CHAIN_CONCAT(CHAIN_FN, 9),  CHAIN_CONCAT(CHAIN_FN, 10),
+    CHAIN_CONCAT(CHAIN_FN, 11), CHAIN_CONCAT(CHAIN_FN, 12),
+    CHAIN_CONCAT(CHAIN_FN, 13), CHAIN_CONCAT(CHAIN_FN, 14),
+    CHAIN_CONCAT(CHAIN_FN, 15), CHAIN_CONCAT(CHAIN_FN, 16),
+};
+
+static const chain_simd_walk_fn CHAIN_CONCAT(CHAIN_WALK_FN, Table)[MAX_PASSWD + 1] = {
+    NULL,
+    CHAIN_CONCAT(CHAIN_WALK_FN, 1),  CHAIN_CONCAT(CHAIN_WALK_FN, 2),
+    CHAIN_CONCAT(CHAIN_WALK_FN, 3),  CHAIN_CONCAT(CHAIN_WALK_FN, 4),
+    CHAIN_CONCAT(CHAIN_WALK_FN, 5),  CHAIN_CONCAT(CHAIN_WALK_FN, 6),
+    CHAIN_CONCAT(CHAIN_WALK_FN, 7),  CHAIN_CONCAT(CHAIN_WALK_FN, 8),
+    CHAIN_CONCAT(CHAIN_WALK_FN, 9),  CHAIN_CONCAT(CHAIN_WALK_FN, 10),
+    CHAIN_CONCAT(CHAIN_WALK_FN, 11), CHAIN_CONCAT(CHAIN_WALK_FN, 12),
+    CHAIN_CONCAT(CHAIN_WALK_FN, 13), CHAIN_CONCAT(CHAIN_WALK_FN, 14),
+    CHAIN_CONCAT(CHAIN_WALK_FN, 15), CHAIN_CONCAT(CHAIN_WALK_FN, 16),
+};
+
+#undef CHAIN_SPECIALIZE
+#undef VEC
+#undef CHAIN_LANES
+#undef CHAIN_FN
+#undef CHAIN_WALK_FN
+#undef CHAIN_TARGET
+#undef VSET1
+#undef VLOAD
+#undef VSTORE
+#undef VADD
+#undef VAND
+#undef VOR
+#undef VXOR
+#undef VNOT
+#undef VSHL
+#undef VSHR
+#undef VROL
+#undef VGATHER
@@ -0,0 +1,149 @@
+#include <assert.h>
+#include <string.h>
+
+#include "chain_walk.h"
+#include "md5_rounds.h"
+
+#if MAX_PASSWD != 16
+#error "chain_walk.c specializes password lengths 1..16 only"
+#endif
+
+#define ALWAYS_INLINE           inline __attribute__((always_inline))
+
+// packs a password into message words terminated by 0x80
+static ALWAYS_INLINE void packPassword(uint32_t *w, const char *password,
+                                       uint32_t length)
+{
+    uint32_t p;
+
+    for (p = 0; p < MD5_FOLDED_WORDS; ++p)
+        w[p] = 0;
+
+    _Pragma("GCC unroll 16")
+    for (p = 0; p < length; ++p)
+        w[p >> 2] |= (uint32_t)(uint8_t)password[p] << ((p & 3) * 8);
+
+    w[length >> 2] |= 0x80U << ((length & 3) * 8);
+}
+
+static ALWAYS_INLINE void unpackPassword(char *password, const uint32_t *w,
+                                         uint32_t length)
+{
+    uint32_t p;
+
+    memset(password, 0, sizeof(password_t));
+
+    _Pragma("GCC unroll 16")
+    for (p = 0; p < length; ++p)
+        password[p] = w[p >> 2] >> ((p & 3) * 8);
+}
+
+// reduce() writing message words directly, see utils.c
+static ALWAYS_INLINE void reduceWords(uint32_t *w, const uint32_t *in,
+                                      uint32_t salt, uint32_t length)
+{
+    uint32_t p;
+
+    for (p = 0; p < MD5_FOLDED_WORDS; ++p)
+        w[p] = 0;
+
+    _Pragma("GCC unroll 16")
+    for (p = 0; p < length; ++p) {
+        uint32_t word = REDUCTION_WORD(in, p / 3) + salt;
+        uint32_t index = (word >> ((p % 3) * 9)) % REDUCTION_TABLE_SIZE;
+
+        w[p >> 2] |= (uint32_t)(uint8_t)reductionMap[index] << ((p & 3) * 8);
+    }
+
+    w[length >> 2] |= 0x80U << ((length & 3) * 8);
+}
+
+static ALWAYS_INLINE void walkFromPassword(hash_t out, const char *password,
+                                           uint32_t steps, uint32_t length)
+{
+    uint32_t w[MD5_FOLDED_WORDS];
+    uint32_t i;
+
+    packPassword(w, password, length);
+    md5_compress_folded(w, 8 * length, out);
+
+    for (i = 0; i < steps; ++i) {
+        reduceWords(w, out, i, length);
+        md5_compress_folded(w, 8 * length, out);
+    }
+}
+
+static ALWAYS_INLINE void walkFromHash(hash_t inout, uint32_t firstSalt,
+                                       uint32_t steps, uint32_t length)
+{
+    uint32_t w[MD5_FOLDED_WORDS];
+    uint32_t i;
+
+    for (i = 0; i < steps; ++i) {
+        reduceWords(w, inout, firstSalt + i, length);
+        md5_compress_folded(w, 8 * length, inout);
+    }
+}
+
+static ALWAYS_INLINE int findInChain(password_t password, const hash_t target,
+                                     uint32_t chainLength, uint32_t length)
+{
+    uint32_t w[MD5_FOLDED_WORDS];
+    hash_t hash;
+    uint32_t i;
+
+    packPassword(w, password, length);
+    md5_compress_folded(w, 8 * length, hash);
+
+    for (i = 0; ; ++i) {
+        if (!memcmp(hash, target, sizeof(hash))) {
+            unpackPassword(password, w, length);
+            return 1;
+        }
+
+        if (i == chainLength)
+            return 0;
+
+        reduceWords(w, hash, i, length);
+        md5_compress_folded(w, 8 * length, hash);
+    }
+}
+
+#define DEFINE_CHAIN_WALKER(n) \
+    static void fromPassword##n(hash_t out, const char *password, \
+                                uint32_t steps) \
+    { \
+        walkFromPassword(out, password, steps, n); \
+    } \
+    static void fromHash##n(hash_t inout, uint32_t firstSalt, uint32_t steps) \
+    { \
+        walkFromHash(inout, firstSalt, steps, n); \
+    } \
+    static int find##n(password_t password, const hash_t target, \
+                       uint32_t chainLength) \
+    { \
+        return findInChain(password, target, chainLength, n); \
+    }
+
+#define CHAIN_WALKER(n)         { n, fromPassword##n, fromHash##n, find##n }
+
+DEFINE_CHAIN_WALKER(1)  DEFINE_CHAIN_WALKER(2)  DEFINE_CHAIN_WALKER(3)
+DEFINE_CHAIN_WALKER(4)  DEFINE_CHAIN_WALKER(5)  DEFINE_CHAIN_WALKER(6)
+DEFINE_CHAIN_WALKER(7)  DEFINE_CHAIN_WALKER(8)  DEFINE_CHAIN_WALKER(9)
+DEFINE_CHAIN_WALKER(10) DEFINE_CHAIN_WALKER(11) DEFINE_CHAIN_WALKER(12)
+DEFINE_CHAIN_WALKER(13) DEFINE_CHAIN_WALKER(14) DEFINE_CHAIN_WALKER(15)
+DEFINE_CHAIN_WALKER(16)
+
+static const struct chain_walker walkers[MAX_PASSWD] = {
+    CHAIN_WALKER(1),  CHAIN_WALKER(2),  CHAIN_WALKER(3),  CHAIN_WALKER(4),
+    CHAIN_WALKER(5),  CHAIN_WALKER(6),  CHAIN_WALKER(7),  CHAIN_WALKER(8),
+    CHAIN_WALKER(9),  CHAIN_WALKER(10), CHAIN_WALKER(11), CHAIN_WALKER(12),
+    CHAIN_WALKER(13), CHAIN_WALKER(14), CHAIN_WALKER(15), CHAIN_WALKER(16),
+};
+
+const struct chain_walker *chainWalker(uint32_t passwordLength)
+{
+    assert(passwordLength >= 1 && passwordLength <= MAX_PASSWD);
+
+    return &walkers[passwordLength - 1];
+}
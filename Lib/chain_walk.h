@@ -0,0 +1,28 @@
+#ifndef _CHAIN_WALK_H
+#define _CHAIN_WALK_H
+
+#include <stdint.h>
+
+#include "utils.h"
+
+// Host-side chain walking primitives, each compiled separately for every
+// password length so that reduce and MD5 have no length dependent loops.
+struct chain_walker {
+    uint32_t passwordLength;
+
+    // hashes password and follows steps chain links, giving the end-point
+    void (*fromPassword)(hash_t out, const char *password, uint32_t steps);
+
+    // follows steps chain links starting with a hash reduced with firstSalt
+    void (*fromHash)(hash_t inout, uint32_t firstSalt, uint32_t steps);
+
+    // walks a chain from its start password looking for target hash,
+    // returns 1 with password replaced by the matching one
+    int (*find)(password_t password, const hash_t target,
+                uint32_t chainLength);
+};
+
+// returns walker for given password length (1..MAX_PASSWD)
+const struct chain_walker *chainWalker(uint32_t passwordLength);
+
+#endif
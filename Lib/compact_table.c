@@ -0,0 +1,84 @@
+#include <string.h>
+
+#include "compact_table.h"
+
+void compactHeaderInit(struct table_header *header,
+                       uint32_t passwordLength, uint32_t chainLength,
+                       uint64_t seed, uint64_t numberOfChains,
+                       uint32_t endBits)
+{
+    tableHeaderInit(header, TABLE_FORMAT_COMPACT, passwordLength, chainLength,
+                    numberOfChains);
+    header->seed = seed;
+    header->indexBits = tableBitsFor(numberOfChains);
+
+    if (!endBits)
+        endBits = header->indexBits <= 32 ? 64 - header->indexBits : 32;
+    header->endBits = endBits;
+
+    header->rowBytes = (header->indexBits + header->endBits + 7) / 8;
+}
+
+// row as two little endian 64-bit words
+static void rowLoad(const uint8_t *row, uint32_t rowBytes, uint64_t word[2])
+{
+    uint32_t i;
+
+    word[0] = word[1] = 0;
+    for (i = 0; i < rowBytes; ++i)
+        word[i / 8] |= (uint64_t)row[i] << ((i % 8) * 8);
+}
+
+static uint64_t rowField(const uint64_t word[2], uint32_t offset,
+                         uint32_t width)
+{
+    uint64_t value;
+
+    if (offset >= 64) {
+        value = word[1] >> (offset - 64);
+    } else {
+        value = word[0] >> offset;
+        if (offset && offset + width > 64)
+            value |= word[1] << (64 - offset);
+    }
+
+    return width < 64 ? value & ((1ull << width) - 1) : value;
+}
+
+void compactRowPack(uint8_t *row, const struct table_header *header,
+                    uint64_t index, uint64_t endKey)
+{
+    uint32_t offset = header->indexBits;
+    uint64_t word[2];
+    uint32_t i;
+
+    word[0] = index;
+    word[1] = 0;
+    if (offset < 64) {
+        word[0] |= endKey << offset;
+        word[1] = offset ? endKey >> (64 - offset) : 0;
+    } else {
+        word[1] = endKey;
+    }
+
+    for (i = 0; i < header->rowBytes; ++i)
+        row[i] = word[i / 8] >> ((i % 8) * 8);
+}
+
+uint64_t compactRowIndex(const uint8_t *row,
+                         const struct table_header *header)
+{
+    uint64_t word[2];
+
+    rowLoad(row, header->rowBytes, word);
+    return rowField(word, 0, header->indexBits);
+}
+
+uint64_t compactRowEnd(const uint8_t *row,
+                       const struct table_header *header)
+{
+    uint64_t word[2];
+
+    rowLoad(row, header->rowBytes, word);
+    return rowField(word, header->indexBits, header->endBits);
+}
@@ -0,0 +1,43 @@
+#ifndef _COMPACT_TABLE_H
+#define _COMPACT_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rainbow_chain.h"
+#include "table_header.h"
+
+// Rows of compact tables (TABLE_FORMAT_COMPACT):
+// ----------------------------------------------------------------------
+// struct table_header : numberOfChains rows of rowBytes bytes
+// ----------------------------------------------------------------------
+// Every row is a little endian bit field of the start index in the low
+// indexBits bits followed by the top endBits bits of hashKey() of the
+// end-point. Rows are sorted by end-point. Start password of chain i is
+// philoxPassword(seed, i), so passwords are not stored.
+
+// rows are read as two 64-bit words
+#define COMPACT_MAX_ROW_BYTES   16
+
+// fills header of a table; endBits of 0 selects the widest end-point which
+// keeps rows 8 bytes long, but at least 32 bits
+void compactHeaderInit(struct table_header *header,
+                       uint32_t passwordLength, uint32_t chainLength,
+                       uint64_t seed, uint64_t numberOfChains,
+                       uint32_t endBits);
+
+// truncated end-point stored in rows, comparable with compactRowEnd()
+static inline uint64_t compactEndKey(const struct table_header *header,
+                                     const hash_t hash)
+{
+    return hashKey(hash) >> (64 - header->endBits);
+}
+
+void compactRowPack(uint8_t *row, const struct table_header *header,
+                    uint64_t index, uint64_t endKey);
+uint64_t compactRowIndex(const uint8_t *row,
+                         const struct table_header *header);
+uint64_t compactRowEnd(const uint8_t *row,
+                       const struct table_header *header);
+
+#endif
@@ -8,25 +8,8 @@
 #include <string.h>
 #include <stdint.h>
 
-// Constants are the integer part of the sines of integers (in radians) * 2^32.
-static const uint32_t k[64] = {
-	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
-	0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
-	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
-	0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
-	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
-	0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
-	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
-	0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
-	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
-	0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
-	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
-	0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
-	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
-	0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
-	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
-	0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
-};
+#include "md5.h"
+#include "md5_rounds.h"
 
 // r specifies the per-round shift amounts
 static const uint32_t r[] = {
@@ -36,9 +19,6 @@ static const uint32_t r[] = {
 	6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
 };
 
-// leftrotate function definition
-#define LEFTROTATE(x, c) (((x) << (c)) | ((x) >> (32 - (c))))
-
 static void to_bytes(uint32_t val, uint8_t *bytes)
 {
 	bytes[0] = (uint8_t) val;
@@ -55,6 +35,53 @@ static uint32_t to_int32(const uint8_t *bytes)
 	       | ((uint32_t) bytes[3] << 24);
 }
 
+// pads a message into a single block of little endian words
+static inline void md5_pad(const uint8_t *msg, size_t len, uint32_t *w)
+{
+	size_t i;
+
+	memset(w, 0, 16 * sizeof(*w));
+
+	for (i = 0; i < len; ++i)
+		w[i >> 2] |= (uint32_t)msg[i] << ((i & 3) * 8);
+
+	w[len >> 2] |= 0x80U << ((len & 3) * 8);
+	w[14] = len * 8;
+}
+
+void md5_short(const void *msg, size_t len, uint32_t *digest)
+{
+	uint32_t w[16];
+
+	md5_pad(msg, len, w);
+
+	if (len <= MD5_FOLDED_MAX_LEN)
+		md5_compress_folded(w, w[14], digest);
+	else
+		md5_compress(w, digest);
+}
+
+void md5_batch(const void *msgs, size_t len, size_t stride, size_t count,
+	       uint32_t *digests)
+{
+	const uint8_t *msg = msgs;
+	uint32_t w[16];
+	size_t i;
+
+	if (len > MD5_FOLDED_MAX_LEN) {
+		for (i = 0; i < count; ++i, msg += stride, digests += 4) {
+			md5_pad(msg, len, w);
+			md5_compress(w, digests);
+		}
+		return;
+	}
+
+	for (i = 0; i < count; ++i, msg += stride, digests += 4) {
+		md5_pad(msg, len, w);
+		md5_compress_folded(w, len * 8, digests);
+	}
+}
+
 void md5(const void *initial_msg, size_t initial_len, uint32_t *digest)
 {
 
@@ -68,6 +95,11 @@ void md5(const void *initial_msg, size_t initial_len, uint32_t *digest)
 	uint32_t w[16];
 	uint32_t a, b, c, d, i, f, g, temp;
 
+	if (initial_len <= MD5_SHORT_MAX_LEN) {
+		md5_short(initial_msg, initial_len, digest);
+		return;
+	}
+
 	// Initialize variables - simple count in nibbles:
 	h0 = 0x67452301;
 	h1 = 0xefcdab89;
@@ -127,7 +159,7 @@ void md5(const void *initial_msg, size_t initial_len, uint32_t *digest)
 			temp = d;
 			d = c;
 			c = b;
-			b = b + LEFTROTATE((a + f + k[i] + w[g]), r[i]);
+			b = b + LEFTROTATE((a + f + md5_k[i] + w[g]), r[i]);
 			a = temp;
 
 		}
@@ -1,10 +1,22 @@
 #ifndef _MD5_H
 #define _MD5_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define MD5_DIGEST_LEN 16
 
+// longest message that fits into a single 64-byte MD5 block with padding
+#define MD5_SHORT_MAX_LEN 55
+
 extern void md5(const void *initial_msg, size_t initial_len, uint32_t *digest);
 
+// hashes a message of up to MD5_SHORT_MAX_LEN bytes without heap allocation
+extern void md5_short(const void *msg, size_t len, uint32_t *digest);
+
+// hashes count messages of len (up to MD5_SHORT_MAX_LEN) bytes each,
+// placed stride bytes apart, into count consecutive four-word digests
+extern void md5_batch(const void *msgs, size_t len, size_t stride,
+                      size_t count, uint32_t *digests);
+
 #endif
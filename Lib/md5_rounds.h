@@ -0,0 +1,129 @@
+/*
+ * Unrolled single-block MD5 transformation shared by md5.c and the
+ * specialized chain walkers
+ */
+#ifndef _MD5_ROUNDS_H
+#define _MD5_ROUNDS_H
+
+#include <stdint.h>
+
+// Constants are the integer part of the sines of integers (in radians) * 2^32.
+static const uint32_t md5_k[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+	0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+	0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+	0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+	0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+	0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+	0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+	0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+	0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+// leftrotate function definition
+#define LEFTROTATE(x, c) (((x) << (c)) | ((x) >> (32 - (c))))
+
+// The basic MD5 functions
+#define F(x, y, z)			((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z)			((y) ^ ((z) & ((x) ^ (y))))
+#define H(x, y, z)			((x) ^ (y) ^ (z))
+#define I(x, y, z)			((y) ^ ((x) | ~(z)))
+
+// The MD5 transformation for all four rounds.
+#define STEP(f, a, b, c, d, i, s) \
+	(a) += f((b), (c), (d)) + W(i) + md5_k[i]; \
+	(a) = LEFTROTATE((a), (s)); \
+	(a) += (b);
+
+// All 64 steps of a single block, W(i) yields message word i
+#define MD5_ROUNDS(a, b, c, d) \
+	STEP(F, a, b, c, d,  0,  7) STEP(F, d, a, b, c,  1, 12) \
+	STEP(F, c, d, a, b,  2, 17) STEP(F, b, c, d, a,  3, 22) \
+	STEP(F, a, b, c, d,  4,  7) STEP(F, d, a, b, c,  5, 12) \
+	STEP(F, c, d, a, b,  6, 17) STEP(F, b, c, d, a,  7, 22) \
+	STEP(F, a, b, c, d,  8,  7) STEP(F, d, a, b, c,  9, 12) \
+	STEP(F, c, d, a, b, 10, 17) STEP(F, b, c, d, a, 11, 22) \
+	STEP(F, a, b, c, d, 12,  7) STEP(F, d, a, b, c, 13, 12) \
+	STEP(F, c, d, a, b, 14, 17) STEP(F, b, c, d, a, 15, 22) \
+	STEP(G, a, b, c, d, 16,  5) STEP(G, d, a, b, c, 17,  9) \
+	STEP(G, c, d, a, b, 18, 14) STEP(G, b, c, d, a, 19, 20) \
+	STEP(G, a, b, c, d, 20,  5) STEP(G, d, a, b, c, 21,  9) \
+	STEP(G, c, d, a, b, 22, 14) STEP(G, b, c, d, a, 23, 20) \
+	STEP(G, a, b, c, d, 24,  5) STEP(G, d, a, b, c, 25,  9) \
+	STEP(G, c, d, a, b, 26, 14) STEP(G, b, c, d, a, 27, 20) \
+	STEP(G, a, b, c, d, 28,  5) STEP(G, d, a, b, c, 29,  9) \
+	STEP(G, c, d, a, b, 30, 14) STEP(G, b, c, d, a, 31, 20) \
+	STEP(H, a, b, c, d, 32,  4) STEP(H, d, a, b, c, 33, 11) \
+	STEP(H, c, d, a, b, 34, 16) STEP(H, b, c, d, a, 35, 23) \
+	STEP(H, a, b, c, d, 36,  4) STEP(H, d, a, b, c, 37, 11) \
+	STEP(H, c, d, a, b, 38, 16) STEP(H, b, c, d, a, 39, 23) \
+	STEP(H, a, b, c, d, 40,  4) STEP(H, d, a, b, c, 41, 11) \
+	STEP(H, c, d, a, b, 42, 16) STEP(H, b, c, d, a, 43, 23) \
+	STEP(H, a, b, c, d, 44,  4) STEP(H, d, a, b, c, 45, 11) \
+	STEP(H, c, d, a, b, 46, 16) STEP(H, b, c, d, a, 47, 23) \
+	STEP(I, a, b, c, d, 48,  6) STEP(I, d, a, b, c, 49, 10) \
+	STEP(I, c, d, a, b, 50, 15) STEP(I, b, c, d, a, 51, 21) \
+	STEP(I, a, b, c, d, 52,  6) STEP(I, d, a, b, c, 53, 10) \
+	STEP(I, c, d, a, b, 54, 15) STEP(I, b, c, d, a, 55, 21) \
+	STEP(I, a, b, c, d, 56,  6) STEP(I, d, a, b, c, 57, 10) \
+	STEP(I, c, d, a, b, 58, 15) STEP(I, b, c, d, a, 59, 21) \
+	STEP(I, a, b, c, d, 60,  6) STEP(I, d, a, b, c, 61, 10) \
+	STEP(I, c, d, a, b, 62, 15) STEP(I, b, c, d, a, 63, 21)
+
+// message word used by step i
+#define MSG_INDEX(i) \
+	((i) < 16 ? (i) : (i) < 32 ? (5 * (i) + 1) % 16 \
+	 : (i) < 48 ? (3 * (i) + 5) % 16 : (7 * (i)) % 16)
+
+// Messages up to 19 bytes leave only words 0-4 and the length word nonzero,
+// all other message words are folded away as constant zeros. Inlined with
+// a constant lenBits, the length word is folded as well.
+#define MD5_FOLDED_WORDS	5
+#define MD5_FOLDED_MAX_LEN	(MD5_FOLDED_WORDS * 4 - 1)
+
+static inline __attribute__((always_inline))
+void md5_compress_folded(const uint32_t *w, uint32_t lenBits,
+				       uint32_t *digest)
+{
+	uint32_t a = 0x67452301;
+	uint32_t b = 0xefcdab89;
+	uint32_t c = 0x98badcfe;
+	uint32_t d = 0x10325476;
+
+#define W(i) (MSG_INDEX(i) < MD5_FOLDED_WORDS ? w[MSG_INDEX(i)] \
+	      : MSG_INDEX(i) == 14 ? lenBits : 0)
+	MD5_ROUNDS(a, b, c, d)
+#undef W
+
+	digest[0] = a + 0x67452301;
+	digest[1] = b + 0xefcdab89;
+	digest[2] = c + 0x98badcfe;
+	digest[3] = d + 0x10325476;
+}
+
+static inline __attribute__((always_inline))
+void md5_compress(const uint32_t *w, uint32_t *digest)
+{
+	uint32_t a = 0x67452301;
+	uint32_t b = 0xefcdab89;
+	uint32_t c = 0x98badcfe;
+	uint32_t d = 0x10325476;
+
+#define W(i) (w[MSG_INDEX(i)])
+	MD5_ROUNDS(a, b, c, d)
+#undef W
+
+	digest[0] = a + 0x67452301;
+	digest[1] = b + 0xefcdab89;
+	digest[2] = c + 0x98badcfe;
+	digest[3] = d + 0x10325476;
+}
+
+#endif
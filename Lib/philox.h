@@ -0,0 +1,51 @@
+#ifndef _PHILOX_H
+#define _PHILOX_H
+
+#include <stdint.h>
+
+#include "utils.h"
+
+// Philox4x32-10 counter-based generator (Salmon et al., "Parallel random
+// numbers: as easy as 1, 2, 3"); rainbow.cl has a copy of it, so that start
+// points generated on the device can be reproduced on the host
+#define PHILOX_M0               0xD2511F53u
+#define PHILOX_M1               0xCD9E8D57u
+#define PHILOX_W0               0x9E3779B9u
+#define PHILOX_W1               0xBB67AE85u
+#define PHILOX_ROUNDS           10
+
+// replaces counter with 128 random bits for the key
+static inline void philox(uint32_t ctr[4], uint64_t key)
+{
+    uint32_t k0 = (uint32_t)key;
+    uint32_t k1 = (uint32_t)(key >> 32);
+    int i;
+
+    for (i = 0; i < PHILOX_ROUNDS; ++i) {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * ctr[0];
+        uint64_t p1 = (uint64_t)PHILOX_M1 * ctr[2];
+
+        ctr[0] = (uint32_t)(p1 >> 32) ^ ctr[1] ^ k0;
+        ctr[1] = (uint32_t)p1;
+        ctr[2] = (uint32_t)(p0 >> 32) ^ ctr[3] ^ k1;
+        ctr[3] = (uint32_t)p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+}
+
+// start password of chain index of a table generated with seed; every
+// character takes 6 bits, five from each random word
+static inline void philoxPassword(char *out, size_t length, uint64_t seed,
+                                  uint64_t index)
+{
+    uint32_t random[4] = { (uint32_t)index, (uint32_t)(index >> 32), 0, 0 };
+    size_t p;
+
+    philox(random, seed);
+
+    for (p = 0; p < length; ++p)
+        out[p] = charset[(random[p / 5] >> ((p % 5) * 6)) % CHARSET_SIZE];
+}
+
+#endif
@@ -3,14 +3,29 @@
 
 #include "utils.h"
 
-// Rainbow Table file format:
+// Rows of chain tables (TABLE_FORMAT_CHAINS), following the header
+// described in table_header.h:
 // ----------------------------------------------------------------------
-// chain length : MD5 hash : password
+// MD5 hash : password
 // ----------------------------------------------------------------------
-// uint32_t     : hash_t   : password_t
+// hash_t   : password_t
 struct rainbow_chain {
     hash_t hash;
     password_t password;
 };
 
+// first 8 bytes of the hash as a big endian number, so that comparing keys
+// gives the same order as memcmp() of hashes
+static inline uint64_t hashKey(const hash_t hash)
+{
+    const uint8_t *bytes = (const uint8_t *)hash;
+    uint64_t key = 0;
+    int i;
+
+    for (i = 0; i < 8; ++i)
+        key = (key << 8) | bytes[i];
+
+    return key;
+}
+
 #endif
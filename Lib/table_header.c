@@ -0,0 +1,75 @@
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "rainbow_chain.h"
+#include "table_header.h"
+
+void tableHeaderInit(struct table_header *header, enum table_format format,
+                     uint32_t passwordLength, uint32_t chainLength,
+                     uint64_t numberOfChains)
+{
+    assert(sizeof(*header) == TABLE_HEADER_SIZE);
+    assert(offsetof(struct table_header, charset) == TABLE_HEADER_FIELDS);
+
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, TABLE_MAGIC, sizeof(header->magic));
+    header->version = TABLE_VERSION;
+    header->headerSize = TABLE_HEADER_SIZE;
+    header->format = format;
+    header->passwordLength = passwordLength;
+    header->chainLength = chainLength;
+    header->numberOfChains = numberOfChains;
+    if (format == TABLE_FORMAT_CHAINS)
+        header->rowBytes = sizeof(struct rainbow_chain);
+
+    header->charsetSize = CHARSET_SIZE;
+    header->reductionTableSize = REDUCTION_TABLE_SIZE;
+    memcpy(header->charset, charset, CHARSET_SIZE);
+    memcpy(header->reductionMap, reductionMap, REDUCTION_TABLE_SIZE);
+}
+
+const char *tableHeaderCheck(const struct table_header *header)
+{
+    if (memcmp(header->magic, TABLE_MAGIC, sizeof(header->magic)))
+        return "not a rainbow table";
+
+    if (header->version != TABLE_VERSION)
+        return "unsupported table version";
+
+    if (header->headerSize != TABLE_HEADER_SIZE)
+        return "unsupported header size";
+
+    if (!header->passwordLength || header->passwordLength > MAX_PASSWD)
+        return "unsupported password length";
+
+    if (!header->chainLength)
+        return "invalid chain length";
+
+    switch (header->format) {
+    case TABLE_FORMAT_CHAINS:
+        if (header->rowBytes != sizeof(struct rainbow_chain))
+            return "invalid row size";
+        break;
+
+    case TABLE_FORMAT_COMPACT:
+        if (!header->indexBits || header->indexBits > 64
+            || !header->endBits || header->endBits > 64
+            || header->rowBytes != (header->indexBits + header->endBits + 7) / 8)
+            return "invalid compact row layout";
+        break;
+
+    default:
+        return "unsupported table format";
+    }
+
+    if (header->charsetSize != CHARSET_SIZE
+        || memcmp(header->charset, charset, CHARSET_SIZE))
+        return "table was generated with a different charset";
+
+    if (header->reductionTableSize != REDUCTION_TABLE_SIZE
+        || memcmp(header->reductionMap, reductionMap, REDUCTION_TABLE_SIZE))
+        return "table was generated with a different reduction map";
+
+    return NULL;
+}
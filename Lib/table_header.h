@@ -0,0 +1,78 @@
+#ifndef _TABLE_HEADER_H
+#define _TABLE_HEADER_H
+
+#include <stdint.h>
+
+#include "utils.h"
+
+// Rainbow Table file header:
+// ----------------------------------------------------------------------
+// struct table_header : rows of the table
+// ----------------------------------------------------------------------
+// The header takes a whole page, so that rows of a mapped table start
+// page aligned, and records everything needed to use the table: its row
+// format, chain parameters and the charset and reduction map it was
+// generated with.
+#define TABLE_MAGIC             "RBWTABLE"
+#define TABLE_VERSION           1
+#define TABLE_HEADER_SIZE       4096
+
+enum table_format {
+    // struct rainbow_chain rows, see rainbow_chain.h
+    TABLE_FORMAT_CHAINS = 1,
+    // start index and truncated end-point rows, see compact_table.h
+    TABLE_FORMAT_COMPACT = 2,
+};
+
+// rows are sorted by end-point
+#define TABLE_FLAG_SORTED       (1u << 0)
+
+// size of the fixed fields preceding charset
+#define TABLE_HEADER_FIELDS     64
+
+struct table_header {
+    char magic[8];
+    uint32_t version;
+    // offset of the first row
+    uint32_t headerSize;
+    uint32_t format;
+    uint32_t flags;
+    uint32_t passwordLength;
+    uint32_t chainLength;
+    uint64_t numberOfChains;
+    // start point seed, rows of compact tables depend on it
+    uint64_t seed;
+    uint32_t rowBytes;
+    // bit widths of compact rows
+    uint32_t indexBits;
+    uint32_t endBits;
+    uint16_t charsetSize;
+    uint16_t reductionTableSize;
+    char charset[CHARSET_SIZE];
+    char reductionMap[REDUCTION_TABLE_SIZE];
+    uint8_t reserved[TABLE_HEADER_SIZE - TABLE_HEADER_FIELDS
+                     - CHARSET_SIZE - REDUCTION_TABLE_SIZE];
+};
+
+// bits needed for values below count, at least 1
+static inline uint32_t tableBitsFor(uint64_t count)
+{
+    uint32_t bits = 1;
+
+    while (bits < 64 && (count - 1) >> bits)
+        ++bits;
+
+    return bits;
+}
+
+// fills header with parameters of this build; rowBytes is set for chain
+// tables, compact tables are set up by compactHeaderInit()
+void tableHeaderInit(struct table_header *header, enum table_format format,
+                     uint32_t passwordLength, uint32_t chainLength,
+                     uint64_t numberOfChains);
+
+// returns NULL if header describes a table this build can use, otherwise
+// a description of the mismatch
+const char *tableHeaderCheck(const struct table_header *header);
+
+#endif
@@ -0,0 +1,56 @@
+#include <string.h>
+
+#include "table_index.h"
+
+uint32_t tableIndexDefaultBits(uint64_t numberOfChains)
+{
+    uint32_t bits = tableBitsFor(numberOfChains);
+
+    if (bits <= TABLE_INDEX_BUCKET_LOG2)
+        return 1;
+
+    bits -= TABLE_INDEX_BUCKET_LOG2;
+    return bits < TABLE_INDEX_MAX_BITS ? bits : TABLE_INDEX_MAX_BITS;
+}
+
+void tableIndexHeaderInit(struct table_index_header *index,
+                          const struct table_header *table, uint32_t bits)
+{
+    memset(index, 0, sizeof(*index));
+    memcpy(index->magic, TABLE_INDEX_MAGIC, sizeof(index->magic));
+    index->version = TABLE_INDEX_VERSION;
+    index->bits = bits;
+    index->numberOfChains = table->numberOfChains;
+    index->seed = table->seed;
+    index->format = table->format;
+    index->chainLength = table->chainLength;
+}
+
+const char *tableIndexCheck(const struct table_index_header *index,
+                            const struct table_header *table, size_t size)
+{
+    if (size < sizeof(*index)
+        || memcmp(index->magic, TABLE_INDEX_MAGIC, sizeof(index->magic)))
+        return "not a table index";
+
+    if (index->version != TABLE_INDEX_VERSION)
+        return "unsupported index version";
+
+    if (!index->bits || index->bits > TABLE_INDEX_MAX_BITS)
+        return "invalid index size";
+
+    // buckets of compact tables have to be ranges of truncated end-points
+    if (table->format == TABLE_FORMAT_COMPACT && index->bits > table->endBits)
+        return "index is finer than end-points of the table";
+
+    if (index->numberOfChains != table->numberOfChains
+        || index->seed != table->seed || index->format != table->format
+        || index->chainLength != table->chainLength)
+        return "index belongs to another table";
+
+    if (size < sizeof(*index) + (((size_t)1 << index->bits) + 1)
+                                * sizeof(uint64_t))
+        return "index is truncated";
+
+    return NULL;
+}
@@ -0,0 +1,50 @@
+#ifndef _TABLE_INDEX_H
+#define _TABLE_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rainbow_chain.h"
+#include "table_header.h"
+
+// Index of a table, stored next to it as <table>.idx:
+// ----------------------------------------------------------------------
+// struct table_index_header : 2^bits + 1 row offsets
+// ----------------------------------------------------------------------
+// Rows with the top bits of hashKey() of their end-point equal to b are
+// rows [offset b, offset b + 1) of the table, so a lookup searches only
+// one bucket of a few rows. The last offset is the number of rows.
+#define TABLE_INDEX_MAGIC       "RBWINDEX"
+#define TABLE_INDEX_VERSION     1
+#define TABLE_INDEX_MAX_BITS    32
+// log2 of average rows in a bucket of the default index
+#define TABLE_INDEX_BUCKET_LOG2 4
+
+struct table_index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t bits;
+    // parameters of the table the index was written for
+    uint64_t numberOfChains;
+    uint64_t seed;
+    uint32_t format;
+    uint32_t chainLength;
+};
+
+static inline uint64_t tableIndexBucket(uint32_t bits, const hash_t hash)
+{
+    return hashKey(hash) >> (64 - bits);
+}
+
+// index bits giving buckets of about 2^TABLE_INDEX_BUCKET_LOG2 rows
+uint32_t tableIndexDefaultBits(uint64_t numberOfChains);
+
+void tableIndexHeaderInit(struct table_index_header *index,
+                          const struct table_header *table, uint32_t bits);
+
+// returns NULL if an index of size bytes matches the table, otherwise
+// a description of the mismatch
+const char *tableIndexCheck(const struct table_index_header *index,
+                            const struct table_header *table, size_t size);
+
+#endif
@@ -0,0 +1,105 @@
+#include <string.h>
+
+#include "table_mph.h"
+
+size_t tableMphFileSize(const struct table_mph_header *header)
+{
+    uint64_t numRanks = header->numWords / TABLE_MPH_RANK_WORDS + 1;
+
+    return sizeof(*header) + (header->numWords + numRanks
+                              + tableMphEntryWords(header)) * sizeof(uint64_t);
+}
+
+const char *tableMphOpen(struct table_mph *mph, const void *data,
+                         size_t size, const struct table_header *table)
+{
+    const struct table_mph_header *header = data;
+    uint32_t i;
+
+    if (size < sizeof(*header)
+        || memcmp(header->magic, TABLE_MPH_MAGIC, sizeof(header->magic)))
+        return "not a perfect hash";
+
+    if (header->version != TABLE_MPH_VERSION)
+        return "unsupported perfect hash version";
+
+    if (header->numberOfChains != table->numberOfChains
+        || header->seed != table->seed || header->format != table->format
+        || header->chainLength != table->chainLength)
+        return "perfect hash belongs to another table";
+
+    if (header->numLevels > TABLE_MPH_MAX_LEVELS
+        || header->rowBits < tableBitsFor(table->numberOfChains)
+        || header->rowBits + header->fingerprintBits > 64
+        || !header->fingerprintBits
+        || header->fingerprintBits > TABLE_MPH_MAX_FINGERPRINT_BITS
+        || header->levelOffset[0]
+        || header->levelOffset[header->numLevels] != header->numWords * 64)
+        return "invalid perfect hash";
+
+    for (i = 0; i < header->numLevels; ++i) {
+        if (header->levelOffset[i + 1] <= header->levelOffset[i])
+            return "invalid perfect hash";
+    }
+
+    if (size < tableMphFileSize(header))
+        return "perfect hash is truncated";
+
+    mph->header = header;
+    mph->words = (const uint64_t *)(header + 1);
+    mph->ranks = mph->words + header->numWords;
+    mph->entries = mph->ranks + header->numWords / TABLE_MPH_RANK_WORDS + 1;
+
+    return NULL;
+}
+
+// set bits of levels before bit
+static uint64_t rankOf(const struct table_mph *mph, uint64_t bit)
+{
+    uint64_t word = bit / 64;
+    uint64_t rank = mph->ranks[word / TABLE_MPH_RANK_WORDS];
+    uint64_t w;
+
+    for (w = word - word % TABLE_MPH_RANK_WORDS; w < word; ++w)
+        rank += __builtin_popcountll(mph->words[w]);
+
+    return rank + __builtin_popcountll(mph->words[word]
+                                       & ((1ull << (bit % 64)) - 1));
+}
+
+int tableMphSlot(const struct table_mph *mph, uint64_t key, uint64_t *slot)
+{
+    const struct table_mph_header *header = mph->header;
+    uint32_t level;
+
+    for (level = 0; level < header->numLevels; ++level) {
+        uint64_t begin = header->levelOffset[level];
+        uint64_t size = header->levelOffset[level + 1] - begin;
+        uint64_t bit = begin + tableMphHash(key, level, size);
+
+        if (mph->words[bit / 64] & (1ull << (bit % 64))) {
+            *slot = rankOf(mph, bit);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int tableMphLookup(const struct table_mph *mph, uint64_t key, uint64_t *row)
+{
+    uint32_t fingerprintBits = mph->header->fingerprintBits;
+    uint64_t slot, entry;
+
+    if (!tableMphSlot(mph, key, &slot))
+        return 0;
+
+    entry = tableMphEntry(mph->entries, slot,
+                          mph->header->rowBits + fingerprintBits);
+    if ((entry & ((1ull << fingerprintBits) - 1))
+        != tableMphFingerprint(key, fingerprintBits))
+        return 0;
+
+    *row = entry >> fingerprintBits;
+    return 1;
+}
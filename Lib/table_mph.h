@@ -0,0 +1,146 @@
+#ifndef _TABLE_MPH_H
+#define _TABLE_MPH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "compact_table.h"
+#include "rainbow_chain.h"
+#include "table_header.h"
+
+// Minimal perfect hash of distinct end-points of a table, stored next to
+// it as <table>.mph:
+// ----------------------------------------------------------------------
+// struct table_mph_header : level bits : rank samples : entries
+// ----------------------------------------------------------------------
+// Levels are bit arrays as in BBHash (Limasset et al., "Fast and scalable
+// minimal perfect hashing for massive key sets"): a key lives at the first
+// level l whose bit tableMphHash(key, l) is set, which happens when no
+// other key left for the level hashed to it. The number of set bits before
+// it is the slot of the key. Entries of slots are packed into a bit array
+// of rowBits + fingerprintBits each: the first row of the key in the top
+// bits and a short fingerprint of the key in the rest, which rejects most
+// keys missing in the table.
+#define TABLE_MPH_MAGIC         "RBWTBMPH"
+#define TABLE_MPH_VERSION       2
+#define TABLE_MPH_MAX_LEVELS    32
+// level bits per key left for the level
+#define TABLE_MPH_GAMMA         2
+// level bits counted by every rank sample
+#define TABLE_MPH_RANK_WORDS    8
+// fingerprint bits of entries by default and at most
+#define TABLE_MPH_FINGERPRINT_BITS      12
+#define TABLE_MPH_MAX_FINGERPRINT_BITS  32
+
+struct table_mph_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t numLevels;
+    // parameters of the table the hash was built for
+    uint64_t numberOfChains;
+    uint64_t seed;
+    uint32_t format;
+    uint32_t chainLength;
+    // distinct end-points
+    uint64_t numKeys;
+    uint32_t rowBits;
+    uint32_t fingerprintBits;
+    // 64-bit words of all levels
+    uint64_t numWords;
+    // first bit of every level and the end of the last one
+    uint64_t levelOffset[TABLE_MPH_MAX_LEVELS + 1];
+    // pads the header to 384 bytes, so that level words start on a cache
+    // line of the mapped file
+    uint8_t reserved[56];
+};
+
+// perfect hash mapped from a file, pointing into it
+struct table_mph {
+    const struct table_mph_header *header;
+    const uint64_t *words;
+    // set bits in words before every TABLE_MPH_RANK_WORDS words
+    const uint64_t *ranks;
+    // packed entries of rowBits + fingerprintBits
+    const uint64_t *entries;
+};
+
+// key of an end-point: hashKey() for chain tables, and the truncated
+// end-point for compact ones
+static inline uint64_t tableMphKey(const struct table_header *table,
+                                   const hash_t hash)
+{
+    if (table->format == TABLE_FORMAT_COMPACT)
+        return compactEndKey(table, hash);
+
+    return hashKey(hash);
+}
+
+// 64-bit finalizer of MurmurHash3, keys of compact tables may be short
+static inline uint64_t tableMphMix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+
+    return x;
+}
+
+// bit of key within level of size bits
+static inline uint64_t tableMphHash(uint64_t key, uint32_t level,
+                                    uint64_t size)
+{
+    return tableMphMix(key + (level + 1) * 0x9e3779b97f4a7c15ull) % size;
+}
+
+static inline uint64_t tableMphFingerprint(uint64_t key, uint32_t bits)
+{
+    return tableMphMix(~key) >> (64 - bits);
+}
+
+// size of the level bits of a level with keys left
+static inline uint64_t tableMphLevelSize(uint64_t keys)
+{
+    return (keys * TABLE_MPH_GAMMA + 63) / 64 * 64;
+}
+
+// 64-bit words of packed entries
+static inline uint64_t tableMphEntryWords(const struct table_mph_header *header)
+{
+    return (header->numKeys * (header->rowBits + header->fingerprintBits)
+            + 63) / 64;
+}
+
+// entry of slot in packed entries of bits each
+static inline uint64_t tableMphEntry(const uint64_t *entries, uint64_t slot,
+                                     uint32_t bits)
+{
+    uint64_t bit = slot * bits;
+    uint32_t shift = bit % 64;
+    uint64_t entry = entries[bit / 64] >> shift;
+
+    if (shift + bits > 64)
+        entry |= entries[bit / 64 + 1] << (64 - shift);
+
+    return bits < 64 ? entry & ((1ull << bits) - 1) : entry;
+}
+
+// bytes of a file with given header
+size_t tableMphFileSize(const struct table_mph_header *header);
+
+// fills mph with pointers into a file of size bytes, returns NULL if the
+// file is a perfect hash of the table, otherwise a description of the
+// mismatch
+const char *tableMphOpen(struct table_mph *mph, const void *data,
+                         size_t size, const struct table_header *table);
+
+// returns 1 and the slot of key if it hashes to a level; keys missing in
+// the set the hash was built for get arbitrary slots or none
+int tableMphSlot(const struct table_mph *mph, uint64_t key, uint64_t *slot);
+
+// returns 1 and the first row of key if the table may hold key; keys
+// missing in the table are rejected but for fingerprint collisions
+int tableMphLookup(const struct table_mph *mph, uint64_t key, uint64_t *row);
+
+#endif
@@ -0,0 +1,257 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+
+#define CACHE_LINE_SIZE         64
+
+// range of loop items owned by one worker, stolen from the back
+struct thread_pool_worker {
+    pthread_mutex_t lock;
+    size_t begin;
+    size_t end;
+    struct thread_pool *pool;
+    unsigned int index;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct thread_pool {
+    unsigned int numThreads;
+    pthread_t *threads;
+    struct thread_pool_worker *workers;
+
+    // serializes concurrent threadPoolFor() callers
+    pthread_mutex_t jobLock;
+
+    pthread_mutex_t lock;
+    pthread_cond_t startCond;
+    pthread_cond_t doneCond;
+    uint64_t generation;
+    unsigned int active;
+    int shutdown;
+
+    thread_pool_fn fn;
+    void *arg;
+    size_t grain;
+};
+
+// takes next chunk from the front of own range
+static int takeLocal(struct thread_pool_worker *worker, size_t grain,
+                     size_t *begin, size_t *end)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->begin < worker->end) {
+        *begin = worker->begin;
+        *end = worker->begin + grain;
+        if (*end > worker->end)
+            *end = worker->end;
+        worker->begin = *end;
+        ret = 1;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    return ret;
+}
+
+// moves back half of the range of another worker to own range
+static int steal(struct thread_pool_worker *self)
+{
+    struct thread_pool *pool = self->pool;
+    size_t grain = pool->grain;
+    unsigned int i;
+
+    for (i = 1; i < pool->numThreads; ++i) {
+        struct thread_pool_worker *victim;
+        size_t begin, end;
+
+        victim = &pool->workers[(self->index + i) % pool->numThreads];
+
+        pthread_mutex_lock(&victim->lock);
+        begin = victim->begin;
+        end = victim->end;
+        if (begin < end) {
+            size_t half = (end - begin) / 2 / grain * grain;
+
+            // begin stays aligned to grain, so does the split point
+            begin += half;
+            victim->end = begin;
+        }
+        pthread_mutex_unlock(&victim->lock);
+
+        if (begin < end) {
+            pthread_mutex_lock(&self->lock);
+            self->begin = begin;
+            self->end = end;
+            pthread_mutex_unlock(&self->lock);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void runWorker(struct thread_pool_worker *worker)
+{
+    struct thread_pool *pool = worker->pool;
+    size_t begin, end;
+
+    do {
+        while (takeLocal(worker, pool->grain, &begin, &end))
+            pool->fn(pool->arg, begin, end, worker->index);
+    } while (steal(worker));
+}
+
+static void *workerThread(void *data)
+{
+    struct thread_pool_worker *worker = data;
+    struct thread_pool *pool = worker->pool;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->generation == seen && !pool->shutdown)
+            pthread_cond_wait(&pool->startCond, &pool->lock);
+        if (pool->shutdown)
+            break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        runWorker(worker);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active == 0)
+            pthread_cond_signal(&pool->doneCond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+struct thread_pool *threadPoolCreate(unsigned int numThreads)
+{
+    struct thread_pool *pool;
+    unsigned int i;
+    int ret;
+
+    if (!numThreads)
+        numThreads = 1;
+
+    pool = calloc(1, sizeof(*pool));
+    assert(pool);
+
+    ret = posix_memalign((void **)&pool->workers, CACHE_LINE_SIZE,
+                         numThreads * sizeof(*pool->workers));
+    assert(ret == 0);
+
+    pool->threads = calloc(numThreads, sizeof(*pool->threads));
+    assert(pool->threads);
+
+    pool->numThreads = numThreads;
+    pthread_mutex_init(&pool->jobLock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->startCond, NULL);
+    pthread_cond_init(&pool->doneCond, NULL);
+
+    for (i = 0; i < numThreads; ++i) {
+        pthread_mutex_init(&pool->workers[i].lock, NULL);
+        pool->workers[i].begin = 0;
+        pool->workers[i].end = 0;
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+    }
+
+    // worker 0 is the thread calling threadPoolFor()
+    for (i = 1; i < numThreads; ++i) {
+        ret = pthread_create(&pool->threads[i], NULL,
+                             workerThread, &pool->workers[i]);
+        assert(ret == 0);
+    }
+
+    return pool;
+}
+
+void threadPoolDestroy(struct thread_pool *pool)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->startCond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 1; i < pool->numThreads; ++i)
+        pthread_join(pool->threads[i], NULL);
+
+    for (i = 0; i < pool->numThreads; ++i)
+        pthread_mutex_destroy(&pool->workers[i].lock);
+
+    pthread_cond_destroy(&pool->doneCond);
+    pthread_cond_destroy(&pool->startCond);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->jobLock);
+
+    free(pool->threads);
+    free(pool->workers);
+    free(pool);
+}
+
+unsigned int threadPoolSize(struct thread_pool *pool)
+{
+    return pool->numThreads;
+}
+
+void threadPoolFor(struct thread_pool *pool, size_t count, size_t grain,
+                   thread_pool_fn fn, void *arg)
+{
+    size_t chunks;
+    unsigned int i;
+
+    if (!count)
+        return;
+    if (!grain)
+        grain = 1;
+
+    pthread_mutex_lock(&pool->jobLock);
+
+    // split the loop evenly, keeping every range aligned to grain
+    chunks = (count + grain - 1) / grain;
+    for (i = 0; i < pool->numThreads; ++i) {
+        struct thread_pool_worker *worker = &pool->workers[i];
+        size_t begin = chunks * i / pool->numThreads * grain;
+        size_t end = chunks * (i + 1) / pool->numThreads * grain;
+
+        pthread_mutex_lock(&worker->lock);
+        worker->begin = begin < count ? begin : count;
+        worker->end = end < count ? end : count;
+        pthread_mutex_unlock(&worker->lock);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->grain = grain;
+    pool->active = pool->numThreads - 1;
+    ++pool->generation;
+    pthread_cond_broadcast(&pool->startCond);
+    pthread_mutex_unlock(&pool->lock);
+
+    runWorker(&pool->workers[0]);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->active)
+        pthread_cond_wait(&pool->doneCond, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_mutex_unlock(&pool->jobLock);
+}
+
+unsigned int threadPoolDefaultSize(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return count > 0 ? count : 1;
+}
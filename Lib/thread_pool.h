@@ -0,0 +1,27 @@
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+#include <stddef.h>
+
+struct thread_pool;
+
+// processes items [begin, end) of a parallel loop on given worker
+typedef void (*thread_pool_fn)(void *arg, size_t begin, size_t end,
+                               unsigned int worker);
+
+// creates a pool of numThreads workers (the calling thread is one of them)
+struct thread_pool *threadPoolCreate(unsigned int numThreads);
+void threadPoolDestroy(struct thread_pool *pool);
+
+unsigned int threadPoolSize(struct thread_pool *pool);
+
+// runs fn over [0, count) in chunks of grain items and waits for completion
+// every range passed to fn starts at a multiple of grain; idle workers steal
+// half of the remaining range of a busy one
+void threadPoolFor(struct thread_pool *pool, size_t count, size_t grain,
+                   thread_pool_fn fn, void *arg);
+
+// returns the number of online CPUs
+unsigned int threadPoolDefaultSize(void);
+
+#endif
@@ -24,20 +24,24 @@ const char reductionMap[REDUCTION_TABLE_SIZE + 1] =
                                     "kmJsB7f0IArk4cwFql.CBPTR2mdpU2qS";
 
 uint32_t reductionStats[256];
+int reductionStatsEnabled;
 
 void reduce(password_t out, hash_t const in, size_t length, uint32_t salt)
 {
     unsigned int i;
 
     for (i = 0; i < (length + 2) / 3; ++i) {
-        uint32_t word = in[i] + salt;
+        uint32_t word = REDUCTION_WORD(in, i) + salt;
         unsigned int j;
 
         for (j = 0; j < 3 && 3 * i + j < length; ++j) {
             uint32_t index = word % REDUCTION_TABLE_SIZE;
 
             out[3 * i + j] = reductionMap[index];
-            ++reductionStats[(uint32_t)reductionMap[index]];
+            // reduce() runs on pool threads, so counts are shared
+            if (reductionStatsEnabled)
+                __atomic_fetch_add(&reductionStats[(uint8_t)out[3 * i + j]],
+                                   1, __ATOMIC_RELAXED);
             word /= REDUCTION_TABLE_SIZE;
         }
     }
@@ -14,13 +14,23 @@ typedef char password_t[MAX_PASSWD];
 #define REDUCTION_TABLE_SIZE    512
 #define CHARSET_SIZE            64
 extern const char charset[CHARSET_SIZE + 1];
+extern const char reductionMap[REDUCTION_TABLE_SIZE + 1];
 extern uint32_t reductionStats[256];
+// reduce() updates reductionStats only when this is set
+extern int reductionStatsEnabled;
+
+// hash word reduced to password characters 3 * i .. 3 * i + 2; a hash has
+// only four words, passwords longer than 12 characters combine them pairwise
+#define REDUCTION_WORD(in, i) \
+    ((i) < 4 ? (in)[(i)] : (in)[(i) & 3] ^ (in)[((i) + 1) & 3])
 
 void reduce(password_t out, hash_t const in, size_t length, uint32_t salt);
 
-static inline void hash(hash_t out, password_t const in)
+// password_t is not zero terminated for MAX_PASSWD long passwords,
+// so its length has to be given
+static inline void hash(hash_t out, password_t const in, size_t length)
 {
-    md5(in, strlen(in), out);
+    md5_short(in, length, out);
 }
 
 #define USEC_PER_SEC            1000000
@@ -0,0 +1,75 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "work_queue.h"
+
+struct work_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    void **items;
+    unsigned int capacity;
+    unsigned int head;
+    unsigned int count;
+};
+
+struct work_queue *workQueueCreate(unsigned int capacity)
+{
+    struct work_queue *queue;
+
+    assert(capacity > 0);
+
+    queue = calloc(1, sizeof(*queue));
+    assert(queue);
+
+    queue->items = calloc(capacity, sizeof(*queue->items));
+    assert(queue->items);
+
+    queue->capacity = capacity;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->notEmpty, NULL);
+    pthread_cond_init(&queue->notFull, NULL);
+
+    return queue;
+}
+
+void workQueueDestroy(struct work_queue *queue)
+{
+    pthread_cond_destroy(&queue->notFull);
+    pthread_cond_destroy(&queue->notEmpty);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->items);
+    free(queue);
+}
+
+void workQueuePush(struct work_queue *queue, void *item)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->capacity)
+        pthread_cond_wait(&queue->notFull, &queue->lock);
+
+    queue->items[(queue->head + queue->count) % queue->capacity] = item;
+    ++queue->count;
+
+    pthread_cond_signal(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void *workQueuePop(struct work_queue *queue)
+{
+    void *item;
+
+    pthread_mutex_lock(&queue->lock);
+    while (!queue->count)
+        pthread_cond_wait(&queue->notEmpty, &queue->lock);
+
+    item = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    --queue->count;
+
+    pthread_cond_signal(&queue->notFull);
+    pthread_mutex_unlock(&queue->lock);
+
+    return item;
+}
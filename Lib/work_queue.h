@@ -0,0 +1,16 @@
+#ifndef _WORK_QUEUE_H
+#define _WORK_QUEUE_H
+
+// bounded FIFO of pointers handed between pipeline stages
+struct work_queue;
+
+struct work_queue *workQueueCreate(unsigned int capacity);
+void workQueueDestroy(struct work_queue *queue);
+
+// appends item, waiting while the queue is full
+void workQueuePush(struct work_queue *queue, void *item);
+
+// removes the oldest item, waiting while the queue is empty
+void *workQueuePop(struct work_queue *queue);
+
+#endif
@@ -1,24 +1,156 @@
 #include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
-
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "chain_simd.h"
+#include "chain_walk.h"
+#include "compact_table.h"
+#include "philox.h"
 #include "rainbow_chain.h"
+#include "table_header.h"
+#include "table_index.h"
+#include "table_mph.h"
+#include "thread_pool.h"
 #include "utils.h"
 
-static FILE *f;
+#ifdef HAVE_OPENCL
+#include <CL/cl.h>
+
+#include "kernel_source.h"
+#include "program_cache.h"
+#endif
+
+// pages touched by one prefault task
+#define PREFAULT_GRAIN          1024
+// chain positions walked together by a search task, a multiple of SIMD
+// lanes of every implementation
+#define SEARCH_GRAIN            16
+// chain positions walked by one OpenCL launch; launches go from short walks
+// to long ones, and end-points of one are probed while the next one runs
+#define OPENCL_POSITIONS        4096
+
+enum engine {
+    ENGINE_CPU,
+    ENGINE_OPENCL,
+};
+
+struct args {
+    const char *table;
+    const char *hash;
+    // 0 takes chain length from the table header
+    uint32_t chainLength;
+    // map the table with MAP_POPULATE
+    uint32_t populate;
+    // read the whole table in parallel before searching
+    uint32_t prefault;
+    uint32_t hugePages;
+    uint32_t numThreads;
+    const char *simd;
+    // search the whole table even if it has an index or a perfect hash
+    uint32_t noIndex;
+    uint32_t noMph;
+    enum engine engine;
+    // OpenCL platform and device index
+    uint32_t platform;
+    uint32_t device;
+    // directory of cached OpenCL program binaries, default one if NULL
+    const char *cacheDir;
+    uint32_t noCache;
+};
+
+static const struct chain_walker *walker;
+static chain_simd_walk_fn chainWalk;
+// tables without header get one filled from arguments, with headerSize 0
+static struct table_header header;
+// whole table mapped read-only, rows start headerSize bytes in
+static const uint8_t *map;
+static size_t mapSize;
+static const uint8_t *rows;
+// optional index of the table, see table_index.h
+static const uint8_t *indexMap;
+static size_t indexMapSize;
+static uint32_t indexBits;
+static const uint64_t *indexOffsets;
+// optional perfect hash of end-points, used instead of the index
+static const uint8_t *mphMap;
+static size_t mphMapSize;
+static struct table_mph mph;
+
+static inline const uint8_t *tableRow(uint64_t index)
+{
+    return rows + index * header.rowBytes;
+}
+
+// compares end-point hash of key with the end-point of row index; compact
+// rows hold only a truncated end-point
+static int endPointCompare(const hash_t key, uint64_t index)
+{
+    uint64_t keyEnd, rowEnd;
+
+    if (header.format == TABLE_FORMAT_CHAINS)
+        return memcmp(key, tableRow(index), sizeof(hash_t));
+
+    keyEnd = compactEndKey(&header, key);
+    rowEnd = compactRowEnd(tableRow(index), &header);
+    return keyEnd < rowEnd ? -1 : keyEnd > rowEnd;
+}
+
+// key of row index as in tableMphKey()
+static inline uint64_t rowKey(uint64_t index)
+{
+    const struct rainbow_chain *chain;
+
+    if (header.format == TABLE_FORMAT_COMPACT)
+        return compactRowEnd(tableRow(index), &header);
+
+    chain = (const struct rainbow_chain *)tableRow(index);
+    return hashKey(chain->hash);
+}
 
-static int chainCompare(const void *a, const void *b)
+static void startPassword(uint64_t index, password_t password)
 {
-    const struct rainbow_chain *key = a;
-    unsigned long index = (unsigned long)b - 1;
-    struct rainbow_chain chain;
-    size_t ret;
+    const struct rainbow_chain *chain;
 
-    fseek(f, index * sizeof(chain), SEEK_SET);
-    ret = fread(&chain, sizeof(chain), 1, f);
-    assert(ret == 1);
+    if (header.format == TABLE_FORMAT_CHAINS) {
+        chain = (const struct rainbow_chain *)tableRow(index);
+        memcpy(password, chain->password, sizeof(password_t));
+        return;
+    }
 
-    return memcmp(key->hash, chain.hash, sizeof(key->hash));
+    philoxPassword(password, header.passwordLength, header.seed,
+                   compactRowIndex(tableRow(index), &header));
+}
+
+// returns the first row whose end-point is not below key, searching only
+// the bucket of key if the table has an index
+static uint64_t lowerBound(const hash_t key)
+{
+    uint64_t begin = 0;
+    uint64_t end = header.numberOfChains;
+
+    if (indexMap) {
+        uint64_t bucket = tableIndexBucket(indexBits, key);
+
+        begin = indexOffsets[bucket];
+        end = indexOffsets[bucket + 1];
+    }
+
+    while (begin < end) {
+        uint64_t middle = begin + (end - begin) / 2;
+
+        if (endPointCompare(key, middle) > 0)
+            begin = middle + 1;
+        else
+            end = middle;
+    }
+
+    return begin;
 }
 
 static void stringToHash(hash_t out, const char *in)
@@ -47,115 +179,717 @@ static void stringToHash(hash_t out, const char *in)
     }
 }
 
-static int lookupChain(FILE *f, const hash_t initialHash,
-                       unsigned long index, struct rainbow_chain *foundChain,
-                       uint32_t passwordLength, uint32_t chainLength)
+// walks every chain ending with endPoint looking for initialHash, returns
+// 1 with the password found
+static int lookupChain(const hash_t initialHash, const hash_t endPoint,
+                       uint32_t chainLength, password_t password)
 {
-    struct rainbow_chain chain;
-    size_t read;
-    uint32_t i;
-    uint32_t offset = 0;
-    int backwards = 0;
+    uint64_t key = tableMphKey(&header, endPoint);
+    uint64_t i;
+
+    if (!mph.header) {
+        i = lowerBound(endPoint);
+    } else if (!tableMphLookup(&mph, key, &i) || rowKey(i) != key) {
+        // not in the table, or a fingerprint collision
+        return 0;
+    }
 
-again:
-    if (backwards) {
-        if (offset > index)
-            return 0;
-        i = index - offset;
-    } else {
-        i = index + offset;
+    // rows of the perfect hash start with the key, which may be shared by
+    // different end-points of chain tables
+    for (; i < header.numberOfChains && rowKey(i) == key; ++i) {
+        if (endPointCompare(endPoint, i))
+            continue;
+        startPassword(i, password);
+        if (walker->find(password, initialHash, chainLength))
+            return 1;
     }
 
-    fseek(f, i * sizeof(chain), SEEK_SET);
-    read = fread(&chain, sizeof(chain), 1, f);
+    return 0;
+}
 
-    if (read != 1
-        || memcmp(chain.hash, foundChain->hash, sizeof(chain.hash)))
-    {
-        if (backwards) {
-            return 0;
-        } else {
-            backwards = 1;
-            offset = 1;
-            goto again;
+struct search {
+    hash_t initialHash;
+    uint32_t chainLength;
+    // set by the task which found the password, stops the others
+    int found;
+    password_t password;
+    pthread_mutex_t lock;
+    // end-points walked by OpenCL, probed by probeEndPoints
+    const hash_t *endPoints;
+};
+
+// looks the end-point up and records the password if it is found, returns
+// 1 once the search is over
+static int probeEndPoint(struct search *search, const hash_t endPoint)
+{
+    password_t password;
+
+    if (__atomic_load_n(&search->found, __ATOMIC_RELAXED))
+        return 1;
+
+    if (!lookupChain(search->initialHash, endPoint, search->chainLength,
+                     password))
+        return 0;
+
+    pthread_mutex_lock(&search->lock);
+    if (!search->found) {
+        memcpy(search->password, password, sizeof(password));
+        __atomic_store_n(&search->found, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&search->lock);
+    return 1;
+}
+
+// walks the hash from chain positions [begin, end) to end-points and looks
+// every group of them up as soon as it is walked; position i is the hash
+// i links before the end of a chain
+static void searchPositions(void *data, size_t begin, size_t end,
+                            unsigned int worker)
+{
+    struct search *search = data;
+    uint32_t salts[SEARCH_GRAIN];
+    uint32_t steps[SEARCH_GRAIN];
+    hash_t hashes[SEARCH_GRAIN];
+    size_t first, count, i;
+
+    for (first = begin; first < end; first += count) {
+        count = end - first < SEARCH_GRAIN ? end - first : SEARCH_GRAIN;
+
+        for (i = 0; i < count; ++i) {
+            memcpy(hashes[i], search->initialHash, sizeof(hash_t));
+            salts[i] = search->chainLength - (first + i);
+            steps[i] = first + i;
         }
+        chainWalk(hashes, salts, steps, count);
+
+        for (i = 0; i < count; ++i)
+            if (probeEndPoint(search, hashes[i]))
+                return;
     }
+}
+
+#ifdef HAVE_OPENCL
+static void probeEndPoints(void *data, size_t begin, size_t end,
+                           unsigned int worker)
+{
+    struct search *search = data;
+    size_t i;
 
-    hash(chain.hash, chain.password);
-    for (i = 0; i < chainLength; ++i) {
-        if (!memcmp(chain.hash, initialHash, sizeof(chain.hash)))
-            goto found;
+    for (i = begin; i < end; ++i)
+        if (probeEndPoint(search, search->endPoints[i]))
+            return;
+}
 
-        reduce(chain.password, chain.hash, passwordLength, i);
-        hash(chain.hash, chain.password);
+// end-points of one launch, read while the next launch runs
+struct cl_launch {
+    cl_mem endPointMem;
+    hash_t *endPoints;
+    cl_event read;
+    uint32_t numPositions;
+};
+
+struct cl_engine {
+    cl_context context;
+    cl_command_queue queue;
+    cl_program program;
+    cl_kernel kernel;
+    cl_mem targetMem;
+    struct cl_launch launches[2];
+};
+
+// picks device --device of platform --platform
+static int findDevice(const struct args *args, cl_platform_id *platformId,
+                      cl_device_id *deviceId)
+{
+    cl_platform_id platformIds[16];
+    cl_device_id deviceIds[16];
+    cl_uint platformIdCount = 0;
+    cl_uint deviceIdCount = 0;
+    char name[128];
+
+    clGetPlatformIDs(16, platformIds, &platformIdCount);
+    if (args->platform >= platformIdCount || args->platform >= 16) {
+        fprintf(stderr, "OpenCL platform %u not found\n", args->platform);
+        return -1;
     }
 
-    if (!memcmp(chain.hash, initialHash, sizeof(chain.hash)))
-            goto found;
+    clGetDeviceIDs(platformIds[args->platform], CL_DEVICE_TYPE_ALL, 16,
+                   deviceIds, &deviceIdCount);
+    if (args->device >= deviceIdCount || args->device >= 16) {
+        fprintf(stderr, "OpenCL device %u not found\n", args->device);
+        return -1;
+    }
 
-    ++offset;
-    goto again;
+    *platformId = platformIds[args->platform];
+    *deviceId = deviceIds[args->device];
 
-found:
-    memcpy(foundChain->hash, initialHash, sizeof(hash_t));
-    strcpy(foundChain->password, chain.password);
-    return 1;
+    name[0] = '\0';
+    clGetDeviceInfo(*deviceId, CL_DEVICE_NAME, sizeof(name), name, NULL);
+    name[sizeof(name) - 1] = '\0';
+    printf("Using OpenCL device %s\n", name);
+    return 0;
 }
 
-int main(int argc, char **argv)
+// creates context, program and buffers for walking search->initialHash
+static int initEngine(const struct args *args, struct cl_engine *engine,
+                      struct search *search)
 {
-    struct rainbow_chain chain;
-    uint32_t passwordLength;
-    uint32_t chainLength;
-    unsigned long index;
-    hash_t initialHash;
-    size_t read;
-    uint32_t i;
-    long len;
+    // layout of struct args in rainbow.cl
+    cl_uint kernelArgs[] = {
+        0,
+        header.chainLength,
+        header.passwordLength,
+        0,
+        0,
+    };
+    cl_context_properties contextProperties[] = {
+        CL_CONTEXT_PLATFORM, 0, 0, 0
+    };
+    size_t size = OPENCL_POSITIONS * sizeof(hash_t);
+    cl_platform_id platformId;
+    cl_device_id deviceId;
+    const char *cacheDir = NULL;
+    char buildOptions[128];
+    cl_int error;
+    unsigned int i;
+
+    if (!args->noCache)
+        cacheDir = args->cacheDir ? args->cacheDir : programCacheDefaultDir();
+
+    if (findDevice(args, &platformId, &deviceId))
+        return -1;
+    contextProperties[1] = (intptr_t)platformId;
+
+    engine->context = clCreateContext(contextProperties, 1, &deviceId,
+                                      NULL, NULL, &error);
+    if (error != CL_SUCCESS)
+        goto err;
+
+    engine->queue = clCreateCommandQueue(engine->context, deviceId, 0,
+                                         &error);
+    if (error != CL_SUCCESS)
+        goto err;
+
+    // specialize the kernel for this table, see PASSWORD_LENGTH in rainbow.cl
+    snprintf(buildOptions, sizeof(buildOptions),
+             "-DPASSWORD_LENGTH=%u -DCHAIN_LENGTH=%u",
+             header.passwordLength, header.chainLength);
+
+    engine->program = programCacheBuild(engine->context, deviceId,
+                                        rainbowKernelSource,
+                                        rainbowKernelSize, buildOptions,
+                                        cacheDir, &error);
+    if (error != CL_SUCCESS)
+        goto err;
+
+    engine->kernel = clCreateKernel(engine->program, "rainbow_endpoints",
+                                    &error);
+    if (error != CL_SUCCESS)
+        goto err;
+
+    engine->targetMem = clCreateBuffer(engine->context,
+                                       CL_MEM_READ_ONLY
+                                       | CL_MEM_COPY_HOST_PTR,
+                                       sizeof(hash_t), search->initialHash,
+                                       &error);
+    if (error != CL_SUCCESS)
+        goto err;
+
+    for (i = 0; i < 2; ++i) {
+        engine->launches[i].endPointMem = clCreateBuffer(engine->context,
+                                                         CL_MEM_WRITE_ONLY,
+                                                         size, NULL, &error);
+        if (error != CL_SUCCESS)
+            goto err;
+        engine->launches[i].endPoints = malloc(size);
+        assert(engine->launches[i].endPoints);
+    }
 
-    f = fopen(argv[1], "rb");
-    assert(f);
+    clSetKernelArg(engine->kernel, 1, sizeof(cl_mem), &engine->targetMem);
+    clSetKernelArg(engine->kernel, 2, sizeof(kernelArgs), kernelArgs);
+    return 0;
 
-    read = fread(&chain, sizeof(chain), 1, f);
-    assert(read == 1);
+err:
+    fprintf(stderr, "OpenCL error %d initializing the device\n", error);
+    return -1;
+}
 
-    passwordLength = strlen(chain.password);
-    stringToHash(initialHash, argv[3]);
-    chainLength = atoi(argv[2]);
+static void releaseEngine(struct cl_engine *engine)
+{
+    unsigned int i;
 
-    printf("Looking for hash %s in table %s\n", argv[3], argv[1]);
-    printf("Password length is %u\n", passwordLength);
+    if (engine->queue)
+        clFinish(engine->queue);
 
-    fseek(f, 0, SEEK_END);
-    len = ftell(f);
-    fseek(f, 0, SEEK_SET);
+    for (i = 0; i < 2; ++i) {
+        if (engine->launches[i].read)
+            clReleaseEvent(engine->launches[i].read);
+        if (engine->launches[i].endPointMem)
+            clReleaseMemObject(engine->launches[i].endPointMem);
+        free(engine->launches[i].endPoints);
+    }
 
-    len /= sizeof(chain);
+    if (engine->targetMem)
+        clReleaseMemObject(engine->targetMem);
+    if (engine->kernel)
+        clReleaseKernel(engine->kernel);
+    if (engine->program)
+        clReleaseProgram(engine->program);
+    if (engine->queue)
+        clReleaseCommandQueue(engine->queue);
+    if (engine->context)
+        clReleaseContext(engine->context);
+}
 
-    printf("Found %ld rainbow chains in table\n", len);
+// walks positions [firstPosition, firstPosition + numPositions) on the
+// device and reads their end-points into the launch
+static cl_int enqueueLaunch(struct cl_engine *engine,
+                            struct cl_launch *launch, uint32_t firstPosition,
+                            uint32_t numPositions)
+{
+#ifdef USE_VECTORS
+    const size_t globalWorkSize[] = { (numPositions + 3) / 4, 0, 0 };
+#else
+    const size_t globalWorkSize[] = { numPositions, 0, 0 };
+#endif
+    cl_uint numPairs = numPositions;
+    cl_int error;
+
+    launch->numPositions = numPositions;
+    if (launch->read) {
+        clReleaseEvent(launch->read);
+        launch->read = NULL;
+    }
 
-    for (i = 0; i <= chainLength; ++i) {
-        uint32_t j;
+    clSetKernelArg(engine->kernel, 0, sizeof(cl_mem), &launch->endPointMem);
+    clSetKernelArg(engine->kernel, 3, sizeof(cl_uint), &firstPosition);
+    clSetKernelArg(engine->kernel, 4, sizeof(cl_uint), &numPositions);
+    clSetKernelArg(engine->kernel, 5, sizeof(cl_uint), &numPairs);
+
+    error = clEnqueueNDRangeKernel(engine->queue, engine->kernel, 1, NULL,
+                                   globalWorkSize, NULL, 0, NULL, NULL);
+    if (error != CL_SUCCESS)
+        return error;
+
+    error = clEnqueueReadBuffer(engine->queue, launch->endPointMem, CL_FALSE,
+                                0, numPositions * sizeof(hash_t),
+                                launch->endPoints, 0, NULL, &launch->read);
+    if (error == CL_SUCCESS)
+        clFlush(engine->queue);
+    return error;
+}
 
-        memcpy(chain.hash, initialHash, sizeof(initialHash));
+// walks chain positions on the OpenCL device and probes their end-points
+// on the pool, one launch behind the device
+static int searchOpenCL(const struct args *args, struct search *search,
+                        struct thread_pool *pool)
+{
+    uint32_t numPositions = header.chainLength + 1;
+    struct cl_engine engine;
+    struct cl_launch *launch;
+    uint32_t next = 0;
+    cl_int error = CL_SUCCESS;
+    unsigned int i;
+    int ret = -1;
+
+    memset(&engine, 0, sizeof(engine));
+    if (initEngine(args, &engine, search))
+        goto out;
+
+    for (i = 0; !search->found && i * OPENCL_POSITIONS < numPositions; ++i) {
+        // keep the device busy with the next launch
+        while (next <= i + 1 && next * OPENCL_POSITIONS < numPositions) {
+            uint32_t first = next * OPENCL_POSITIONS;
+            uint32_t count = numPositions - first < OPENCL_POSITIONS
+                             ? numPositions - first : OPENCL_POSITIONS;
+
+            error = enqueueLaunch(&engine, &engine.launches[next % 2],
+                                  first, count);
+            if (error != CL_SUCCESS)
+                goto err;
+            ++next;
+        }
+
+        launch = &engine.launches[i % 2];
+        error = clWaitForEvents(1, &launch->read);
+        if (error != CL_SUCCESS)
+            goto err;
+
+        search->endPoints = (const hash_t *)launch->endPoints;
+        threadPoolFor(pool, launch->numPositions, SEARCH_GRAIN,
+                      probeEndPoints, search);
+    }
+
+    ret = 0;
+    goto out;
+
+err:
+    fprintf(stderr, "OpenCL error %d walking chain positions\n", error);
+out:
+    releaseEngine(&engine);
+    return ret;
+}
+#endif
 
-        for (j = 0; j < i; ++j) {
-            reduce(chain.password, chain.hash,
-                    passwordLength, chainLength - i + j);
-            hash(chain.hash, chain.password);
+// checks header of the table and that the table holds all its rows
+static const char *checkTable(uint32_t chainLength)
+{
+    const char *error;
+
+    error = tableHeaderCheck(&header);
+    if (error)
+        return error;
+
+    if (!(header.flags & TABLE_FLAG_SORTED))
+        return "table is not sorted";
+
+    if (chainLength && chainLength != header.chainLength)
+        return "chain length differs from the table";
+
+    if (mapSize < header.headerSize + header.numberOfChains * header.rowBytes)
+        return "table is truncated";
+
+    return NULL;
+}
+
+// tables written before table_header.h are bare arrays of chains; their
+// password length is guessed from the first chain
+static void readHeaderless(uint32_t chainLength)
+{
+    const struct rainbow_chain *chain = (const struct rainbow_chain *)map;
+
+    tableHeaderInit(&header, TABLE_FORMAT_CHAINS,
+                    strnlen(chain->password, MAX_PASSWD), chainLength,
+                    mapSize / sizeof(*chain));
+    header.headerSize = 0;
+}
+
+static void prefaultPages(void *arg, size_t begin, size_t end,
+                          unsigned int worker)
+{
+    long pageSize = sysconf(_SC_PAGESIZE);
+    const uint8_t *base = arg;
+    volatile uint8_t sum = 0;
+    size_t i;
+
+    for (i = begin; i < end; ++i)
+        sum += base[i * pageSize];
+}
+
+// maps a file read-only, NULL if it cannot be opened, or if it is empty
+// and not required; lookups jump around the whole file, so read-ahead is
+// disabled unless the file is prefaulted
+static const uint8_t *mapFile(const struct args *args, const char *path,
+                              size_t *size, int required)
+{
+    long pageSize = sysconf(_SC_PAGESIZE);
+    struct thread_pool *pool;
+    const uint8_t *base;
+    struct stat st;
+    uint64_t start;
+    int flags = MAP_SHARED;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st)) {
+        perror("Error reading file");
+        exit(1);
+    }
+
+    if (!st.st_size) {
+        if (required) {
+            fprintf(stderr, "File %s is empty\n", path);
+            exit(1);
         }
+        close(fd);
+        return NULL;
+    }
+    *size = st.st_size;
+
+#ifdef MAP_POPULATE
+    if (args->populate)
+        flags |= MAP_POPULATE;
+#endif
+
+    start = getTime();
+    base = mmap(NULL, *size, PROT_READ, flags, fd, 0);
+    if (base == MAP_FAILED) {
+        perror("Error mapping file");
+        exit(1);
+    }
+    close(fd);
 
-        index = (unsigned long)bsearch(&chain, (void *)1, len, 1, chainCompare);
-        if (index && lookupChain(f, initialHash, index - 1,
-                                    &chain, passwordLength, chainLength))
-            break;
+#ifdef MADV_HUGEPAGE
+    // file backed huge pages need a kernel with read-only file THP
+    if (args->hugePages && madvise((void *)base, *size, MADV_HUGEPAGE))
+        perror("Huge pages unavailable");
+#endif
+
+    if (!args->prefault) {
+        if (!args->populate)
+            madvise((void *)base, *size, MADV_RANDOM);
+    } else {
+        madvise((void *)base, *size, MADV_WILLNEED);
+        pool = threadPoolCreate(args->numThreads);
+        threadPoolFor(pool, (*size + pageSize - 1) / pageSize,
+                      PREFAULT_GRAIN, prefaultPages, (void *)base);
+        threadPoolDestroy(pool);
     }
 
-    if (i > chainLength)
-        printf("Failed to find password for given hash\n");
+    if (args->populate || args->prefault)
+        printf("Loaded %lu MiB of %s in %.2f sec\n",
+               (unsigned long)(*size >> 20), path,
+               (float)measureTime(start) / USEC_PER_SEC);
+
+    return base;
+}
+
+// maps <table>.idx if it exists and belongs to the table
+static void mapIndex(const struct args *args)
+{
+    char path[PATH_MAX];
+    const char *error;
+
+    if (snprintf(path, sizeof(path), "%s.idx", args->table) >= sizeof(path))
+        return;
+
+    indexMap = mapFile(args, path, &indexMapSize, 0);
+    if (!indexMap)
+        return;
+
+    error = tableIndexCheck((const struct table_index_header *)indexMap,
+                            &header, indexMapSize);
+    if (error) {
+        fprintf(stderr, "Ignoring index %s: %s\n", path, error);
+        munmap((void *)indexMap, indexMapSize);
+        indexMap = NULL;
+        return;
+    }
+
+    indexBits = ((const struct table_index_header *)indexMap)->bits;
+    indexOffsets = (const uint64_t *)(indexMap
+                                      + sizeof(struct table_index_header));
+    printf("Using index %s of %u-bit buckets\n", path, indexBits);
+}
+
+// maps <table>.mph if it exists and belongs to the table
+static void mapMph(const struct args *args)
+{
+    char path[PATH_MAX];
+    const char *error;
+
+    if (snprintf(path, sizeof(path), "%s.mph", args->table) >= sizeof(path))
+        return;
+
+    mphMap = mapFile(args, path, &mphMapSize, 0);
+    if (!mphMap)
+        return;
+
+    error = tableMphOpen(&mph, mphMap, mphMapSize, &header);
+    if (error) {
+        fprintf(stderr, "Ignoring perfect hash %s: %s\n", path, error);
+        munmap((void *)mphMap, mphMapSize);
+        mphMap = NULL;
+        return;
+    }
+
+    printf("Using perfect hash %s of %lu end-points\n", path,
+           (unsigned long)mph.header->numKeys);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [--populate] [--prefault] [--huge-pages] "
+            "[--threads N] [--simd avx512|avx2|sse2|scalar] "
+            "[--no-index] [--no-mph] [--engine cpu|opencl] "
+            "[--platform N] [--device N] [--cache-dir DIR] [--no-cache] "
+            "table [chain_length] hash\n", name);
+    exit(1);
+}
+
+static void parseArgs(struct args *args, int argc, char **argv)
+{
+    const char *positional[3];
+    unsigned int numPositional = 0;
+    int i;
+
+    memset(args, 0, sizeof(*args));
+    args->numThreads = threadPoolDefaultSize();
+
+    for (i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--populate")) {
+            args->populate = 1;
+        } else if (!strcmp(argv[i], "--prefault")) {
+            args->prefault = 1;
+        } else if (!strcmp(argv[i], "--huge-pages")) {
+            args->hugePages = 1;
+        } else if (!strcmp(argv[i], "--no-index")) {
+            args->noIndex = 1;
+        } else if (!strcmp(argv[i], "--no-mph")) {
+            args->noMph = 1;
+        } else if (!strcmp(argv[i], "--simd")) {
+            if (++i == argc)
+                usage(argv[0]);
+            args->simd = argv[i];
+        } else if (!strcmp(argv[i], "--engine")) {
+            if (++i == argc)
+                usage(argv[0]);
+            if (!strcmp(argv[i], "cpu"))
+                args->engine = ENGINE_CPU;
+            else if (!strcmp(argv[i], "opencl"))
+                args->engine = ENGINE_OPENCL;
+            else
+                usage(argv[0]);
+        } else if (!strcmp(argv[i], "--platform")) {
+            if (++i == argc)
+                usage(argv[0]);
+            args->platform = atoi(argv[i]);
+        } else if (!strcmp(argv[i], "--device")) {
+            if (++i == argc)
+                usage(argv[0]);
+            args->device = atoi(argv[i]);
+        } else if (!strcmp(argv[i], "--cache-dir")) {
+            if (++i == argc)
+                usage(argv[0]);
+            args->cacheDir = argv[i];
+        } else if (!strcmp(argv[i], "--no-cache")) {
+            args->noCache = 1;
+        } else if (!strcmp(argv[i], "--threads")) {
+            if (++i == argc)
+                usage(argv[0]);
+            args->numThreads = atoi(argv[i]);
+            if (!args->numThreads)
+                usage(argv[0]);
+        } else if (argv[i][0] == '-' || numPositional == 3) {
+            usage(argv[0]);
+        } else {
+            positional[numPositional++] = argv[i];
+        }
+    }
+
+    if (numPositional < 2)
+        usage(argv[0]);
+
+#ifndef HAVE_OPENCL
+    if (args->engine == ENGINE_OPENCL) {
+        fprintf(stderr, "OpenCL engine is not supported by this build\n");
+        exit(1);
+    }
+#endif
+
+    args->table = positional[0];
+    args->hash = positional[numPositional - 1];
+    if (numPositional == 3)
+        args->chainLength = atoi(positional[1]);
+}
+
+int main(int argc, char **argv)
+{
+    const struct chain_simd *chainSimd;
+    struct thread_pool *pool;
+    struct search search;
+    struct args args;
+    const char *error;
+    uint64_t start;
+    int ret = 0;
+
+    parseArgs(&args, argc, argv);
+
+    if (strlen(args.hash) != 32) {
+        fprintf(stderr, "Hash %s is not 32 hex digits long\n", args.hash);
+        return 1;
+    }
+
+    map = mapFile(&args, args.table, &mapSize, 1);
+    if (!map) {
+        perror("Error opening table");
+        return 1;
+    }
+
+    if (mapSize >= sizeof(header)
+        && !memcmp(map, TABLE_MAGIC, sizeof(header.magic))) {
+        memcpy(&header, map, sizeof(header));
+        error = checkTable(args.chainLength);
+        if (error) {
+            fprintf(stderr, "Cannot use table %s: %s\n", args.table, error);
+            return 1;
+        }
+        if (!args.noMph)
+            mapMph(&args);
+        if (!mphMap && !args.noIndex)
+            mapIndex(&args);
+    } else if (args.chainLength) {
+        readHeaderless(args.chainLength);
+    } else {
+        fprintf(stderr, "Table %s has no header, its chain length "
+                "has to be given\n", args.table);
+        return 1;
+    }
+    rows = map + header.headerSize;
+
+    if (args.simd) {
+        chainSimd = chainSimdFind(args.simd);
+        if (!chainSimd) {
+            fprintf(stderr, "SIMD implementation %s is not supported\n",
+                    args.simd);
+            return 1;
+        }
+    } else {
+        chainSimd = chainSimdSelect();
+    }
+
+    printf("Looking for hash %s in table %s\n", args.hash, args.table);
+    printf("Password length is %u\n", header.passwordLength);
+
+    assert(header.passwordLength >= 1 && header.passwordLength <= MAX_PASSWD);
+    walker = chainWalker(header.passwordLength);
+    chainWalk = chainSimd->walk[header.passwordLength];
+
+    printf("Found %lu rainbow chains in table\n",
+           (unsigned long)header.numberOfChains);
+
+    if (args.engine == ENGINE_OPENCL)
+        printf("Searching %u chain positions on OpenCL, %u threads probing\n",
+               header.chainLength + 1, args.numThreads);
     else
-        printf("Found password: %s\n", chain.password);
+        printf("Searching %u chain positions, %u threads, %s chain kernel\n",
+               header.chainLength + 1, args.numThreads, chainSimd->name);
+
+    memset(&search, 0, sizeof(search));
+    stringToHash(search.initialHash, args.hash);
+    search.chainLength = header.chainLength;
+    pthread_mutex_init(&search.lock, NULL);
+
+    start = getTime();
+    pool = threadPoolCreate(args.numThreads);
+#ifdef HAVE_OPENCL
+    if (args.engine == ENGINE_OPENCL && searchOpenCL(&args, &search, pool))
+        ret = 1;
+#endif
+    if (args.engine == ENGINE_CPU)
+        threadPoolFor(pool, header.chainLength + 1, SEARCH_GRAIN,
+                      searchPositions, &search);
+    threadPoolDestroy(pool);
+    pthread_mutex_destroy(&search.lock);
+
+    if (!ret) {
+        printf("Search time: %.3f sec\n",
+               (float)measureTime(start) / USEC_PER_SEC);
+
+        if (!search.found)
+            printf("Failed to find password for given hash\n");
+        else
+            printf("Found password: %.*s\n", header.passwordLength,
+                   search.password);
+    }
 
-    fclose(f);
-    return 0;
+    if (mphMap)
+        munmap((void *)mphMap, mphMapSize);
+    if (indexMap)
+        munmap((void *)indexMap, indexMapSize);
+    munmap((void *)map, mapSize);
+    return ret;
 }
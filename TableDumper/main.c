@@ -1,22 +1,100 @@
 #include <assert.h>
 #include <stdio.h>
 
+#include "compact_table.h"
+#include "philox.h"
 #include "rainbow_chain.h"
+#include "table_header.h"
 
-int main(int argc, char **argv)
+static const char *formatName(uint32_t format)
+{
+    switch (format) {
+    case TABLE_FORMAT_CHAINS:
+        return "chains";
+    case TABLE_FORMAT_COMPACT:
+        return "compact";
+    default:
+        return "unknown";
+    }
+}
+
+static void printHeader(const struct table_header *header)
+{
+    const char *error = tableHeaderCheck(header);
+
+    printf("# %s table version %u, %u-character passwords, chain length %u, "
+           "%llu chains%s\n", formatName(header->format), header->version,
+           header->passwordLength, header->chainLength,
+           (unsigned long long)header->numberOfChains,
+           header->flags & TABLE_FLAG_SORTED ? ", sorted" : "");
+    printf("# start point seed %llu, %u-byte rows\n",
+           (unsigned long long)header->seed, header->rowBytes);
+    if (header->format == TABLE_FORMAT_COMPACT)
+        printf("# %u-bit start index, %u-bit end-points\n",
+               header->indexBits, header->endBits);
+    if (error)
+        printf("# %s\n", error);
+}
+
+// prints start index, start password and truncated end-point of every row
+static void dumpCompact(FILE *f, const struct table_header *header)
+{
+    uint8_t row[COMPACT_MAX_ROW_BYTES];
+    password_t password;
+    uint64_t i;
+
+    for (i = 0; i < header->numberOfChains; ++i) {
+        uint64_t index;
+
+        if (fread(row, header->rowBytes, 1, f) != 1)
+            break;
+
+        index = compactRowIndex(row, header);
+        philoxPassword(password, header->passwordLength, header->seed, index);
+        printf("%llu %.*s : %0*llx\n", (unsigned long long)index,
+               (int)header->passwordLength, password,
+               (int)(header->endBits + 3) / 4,
+               (unsigned long long)compactRowEnd(row, header));
+    }
+}
+
+static void dumpChains(FILE *f)
 {
     struct rainbow_chain chain;
-    FILE *f;
     char hash[33];
 
+    while (fread(&chain, sizeof(chain), 1, f) == 1) {
+        printHash(hash, chain.hash);
+        printf("%.*s : %s\n", MAX_PASSWD, chain.password, hash);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct table_header header;
+    FILE *f;
+
     f = fopen(argv[1], "rb");
     assert(f);
 
-    while (fread(&chain, sizeof(chain), 1, f) == 1) {
-        printHash(hash, chain.hash);
-        printf("%s : %s\n", chain.password, hash);
+    // tables written before table_header.h have no header
+    if (fread(&header, sizeof(header), 1, f) != 1
+        || memcmp(header.magic, TABLE_MAGIC, sizeof(header.magic))) {
+        fseek(f, 0, SEEK_SET);
+        dumpChains(f);
+        fclose(f);
+        return 0;
     }
 
+    printHeader(&header);
+    fseek(f, header.headerSize, SEEK_SET);
+
+    if (header.format == TABLE_FORMAT_COMPACT
+        && header.rowBytes <= COMPACT_MAX_ROW_BYTES)
+        dumpCompact(f, &header);
+    else if (header.format == TABLE_FORMAT_CHAINS)
+        dumpChains(f);
+
     fclose(f);
 
     return 0;
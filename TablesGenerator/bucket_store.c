@@ -0,0 +1,255 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "bucket_store.h"
+#include "chain_sort.h"
+#include "merge.h"
+
+// file descriptors left for the process besides bucket files
+#define RESERVED_FDS            32
+
+struct bucket_store {
+    uint32_t passwordLength;
+    unsigned int bits;
+    unsigned int numBuckets;
+
+    int *files;
+    // chains stored or reserved in every bucket
+    uint64_t *counts;
+
+    // protects counts, files are written outside of it at reserved offsets
+    pthread_mutex_t lock;
+};
+
+static inline unsigned int bucketOf(const struct bucket_store *store,
+                                    const hash_t hash)
+{
+    return hashKey(hash) >> (64 - store->bits);
+}
+
+static void bucketFileName(char *out, const struct bucket_store *store,
+                           unsigned int bucket)
+{
+    sprintf(out, "rainbow-len%u-b%04x.tmp", store->passwordLength, bucket);
+}
+
+struct bucket_store *bucketStoreCreate(uint32_t passwordLength,
+                                       unsigned int bits)
+{
+    struct bucket_store *store;
+    struct rlimit limit;
+    char filename[64];
+    unsigned int i;
+
+    assert(bits > 0 && bits < 32);
+
+    if (!getrlimit(RLIMIT_NOFILE, &limit) && limit.rlim_cur != RLIM_INFINITY
+        && limit.rlim_cur < (1ull << bits) + RESERVED_FDS) {
+        fprintf(stderr, "%u buckets exceed the limit of %lu open files\n",
+                1u << bits, (unsigned long)limit.rlim_cur);
+        exit(1);
+    }
+
+    store = calloc(1, sizeof(*store));
+    assert(store);
+
+    store->passwordLength = passwordLength;
+    store->bits = bits;
+    store->numBuckets = 1u << bits;
+    pthread_mutex_init(&store->lock, NULL);
+
+    store->files = malloc(store->numBuckets * sizeof(*store->files));
+    assert(store->files);
+    store->counts = calloc(store->numBuckets, sizeof(*store->counts));
+    assert(store->counts);
+
+    for (i = 0; i < store->numBuckets; ++i) {
+        bucketFileName(filename, store, i);
+        store->files[i] = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (store->files[i] < 0) {
+            perror("Error opening bucket");
+            exit(1);
+        }
+    }
+
+    return store;
+}
+
+void bucketStoreDestroy(struct bucket_store *store)
+{
+    char filename[64];
+    unsigned int i;
+
+    for (i = 0; i < store->numBuckets; ++i) {
+        close(store->files[i]);
+        bucketFileName(filename, store, i);
+        unlink(filename);
+    }
+
+    free(store->counts);
+    free(store->files);
+    pthread_mutex_destroy(&store->lock);
+    free(store);
+}
+
+void bucketStoreAdd(struct bucket_store *store,
+                    const struct rainbow_chain *chains, size_t count)
+{
+    struct rainbow_chain *scattered;
+    uint64_t *starts;
+    size_t *offsets;
+    unsigned int b;
+    size_t i;
+
+    // the block is grouped by the caller, so that adds of several threads
+    // only share the bucket counts
+    scattered = malloc(count * sizeof(*scattered));
+    assert(scattered);
+    offsets = calloc(store->numBuckets + 1, sizeof(*offsets));
+    assert(offsets);
+    starts = malloc(store->numBuckets * sizeof(*starts));
+    assert(starts);
+
+    // counting sort by bucket, so that each bucket gets one write
+    for (i = 0; i < count; ++i)
+        ++offsets[bucketOf(store, chains[i].hash) + 1];
+    for (b = 0; b < store->numBuckets; ++b)
+        offsets[b + 1] += offsets[b];
+
+    for (i = 0; i < count; ++i)
+        scattered[offsets[bucketOf(store, chains[i].hash)]++] = chains[i];
+
+    // offsets[b] now points past bucket b; room in bucket files is
+    // reserved under the lock and written outside of it
+    pthread_mutex_lock(&store->lock);
+    for (b = 0; b < store->numBuckets; ++b) {
+        size_t size = offsets[b] - (b ? offsets[b - 1] : 0);
+
+        starts[b] = store->counts[b];
+        store->counts[b] += size;
+    }
+    pthread_mutex_unlock(&store->lock);
+
+    for (b = 0; b < store->numBuckets; ++b) {
+        size_t begin = b ? offsets[b - 1] : 0;
+        size_t size = offsets[b] - begin;
+
+        if (!size)
+            continue;
+
+        chainsWrite(store->files[b], &scattered[begin], size,
+                    starts[b] * sizeof(struct rainbow_chain));
+    }
+
+    free(starts);
+    free(offsets);
+    free(scattered);
+}
+
+// per-thread state of the final sort
+struct bucket_worker {
+    struct thread_pool *pool;
+    struct chain_sorter *sorter;
+    struct rainbow_chain *chains;
+};
+
+struct bucket_sort {
+    struct bucket_store *store;
+    struct bucket_worker *workers;
+    // first output chain of every bucket
+    uint64_t *outStart;
+    uint64_t maxCount;
+    int out;
+    off_t offset;
+};
+
+static void sortBuckets(void *data, size_t begin, size_t end,
+                        unsigned int worker)
+{
+    struct bucket_sort *sort = data;
+    struct bucket_store *store = sort->store;
+    struct bucket_worker *self = &sort->workers[worker];
+    size_t b;
+
+    // pool tasks cannot nest, so every thread sorts its buckets with
+    // a single-threaded sorter of its own
+    if (!self->sorter) {
+        self->pool = threadPoolCreate(1);
+        self->sorter = chainSorterCreate(self->pool, sort->maxCount);
+        self->chains = malloc(sort->maxCount * sizeof(*self->chains));
+        assert(self->chains);
+    }
+
+    for (b = begin; b < end; ++b) {
+        uint64_t count = store->counts[b];
+        struct rainbow_chain *sorted;
+
+        if (!count)
+            continue;
+
+        chainsRead(store->files[b], self->chains, count, 0);
+        sorted = chainSort(self->sorter, self->chains, count);
+        chainsWrite(sort->out, sorted, count,
+                    sort->offset + sort->outStart[b] * sizeof(*sorted));
+    }
+}
+
+void bucketStoreFinish(struct bucket_store *store, struct thread_pool *pool,
+                       const char *path, off_t offset)
+{
+    unsigned int numThreads = threadPoolSize(pool);
+    struct bucket_sort sort;
+    uint64_t total = 0;
+    unsigned int b, i;
+    int ret;
+
+    sort.store = store;
+    sort.maxCount = 0;
+    sort.offset = offset;
+    sort.outStart = malloc(store->numBuckets * sizeof(*sort.outStart));
+    assert(sort.outStart);
+    sort.workers = calloc(numThreads, sizeof(*sort.workers));
+    assert(sort.workers);
+
+    for (b = 0; b < store->numBuckets; ++b) {
+        sort.outStart[b] = total;
+        total += store->counts[b];
+        if (store->counts[b] > sort.maxCount)
+            sort.maxCount = store->counts[b];
+    }
+
+    printf("Sorting %u buckets of up to %lu chains...\n",
+           store->numBuckets, (unsigned long)sort.maxCount);
+
+    sort.out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (sort.out < 0) {
+        perror("Error opening table");
+        exit(1);
+    }
+
+    ret = posix_fallocate(sort.out, offset,
+                          total * sizeof(struct rainbow_chain));
+    if (ret) {
+        fprintf(stderr, "Error preallocating %s: %s\n", path, strerror(ret));
+        exit(1);
+    }
+
+    threadPoolFor(pool, store->numBuckets, 1, sortBuckets, &sort);
+    close(sort.out);
+
+    for (i = 0; i < numThreads; ++i) {
+        if (!sort.workers[i].sorter)
+            continue;
+        chainSorterDestroy(sort.workers[i].sorter);
+        threadPoolDestroy(sort.workers[i].pool);
+        free(sort.workers[i].chains);
+    }
+    free(sort.workers);
+    free(sort.outStart);
+}
@@ -0,0 +1,29 @@
+#ifndef _BUCKET_STORE_H
+#define _BUCKET_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "rainbow_chain.h"
+#include "thread_pool.h"
+
+// unsorted chains distributed into 2^bits files by end-point hash prefix
+struct bucket_store;
+
+struct bucket_store *bucketStoreCreate(uint32_t passwordLength,
+                                       unsigned int bits);
+void bucketStoreDestroy(struct bucket_store *store);
+
+// appends chains of an unsorted block to their buckets; may be called from
+// several threads
+void bucketStoreAdd(struct bucket_store *store,
+                    const struct rainbow_chain *chains, size_t count);
+
+// sorts every bucket in memory, in parallel with one bucket per pool task,
+// and writes them one after another into the file at path, starting at
+// byte offset
+void bucketStoreFinish(struct bucket_store *store, struct thread_pool *pool,
+                       const char *path, off_t offset);
+
+#endif
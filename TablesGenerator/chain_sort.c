@@ -0,0 +1,316 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chain_sort.h"
+
+// The first pass partitions chains in place by the top byte of the key,
+// American flag style, then every partition is sorted independently: its
+// (key, index) pairs by LSD passes over the next 48 bits, the few pairs
+// still tied after 56 bits by full hash, and the chains of the partition
+// are permuted in place to follow them. Besides the block, only pairs of
+// the largest partition are allocated by every worker.
+#define MSD_BITS                8
+#define MSD_BUCKETS             (1 << MSD_BITS)
+#define LSD_BITS                12
+#define LSD_BUCKETS             (1 << LSD_BITS)
+#define LSD_PASSES              4
+#define SORTED_BITS             (MSD_BITS + LSD_BITS * LSD_PASSES)
+
+// tiles per thread, for load balancing of the histogram pass
+#define TILES_PER_THREAD        4
+
+struct sort_entry {
+    uint64_t key;
+    uint32_t index;
+    uint32_t reserved;
+};
+
+// pairs of the partition being sorted and their LSD histograms
+struct sort_worker {
+    struct sort_entry *entries;
+    struct sort_entry *tmp;
+    size_t capacity;
+    uint32_t counts[LSD_PASSES][LSD_BUCKETS];
+};
+
+struct chain_sorter {
+    struct thread_pool *pool;
+    size_t maxChains;
+
+    unsigned int numTiles;
+    size_t (*tileCounts)[MSD_BUCKETS];
+    size_t bucketStart[MSD_BUCKETS + 1];
+    struct sort_worker *workers;
+
+    // block being sorted
+    struct rainbow_chain *chains;
+    size_t count;
+};
+
+static inline unsigned int msdDigit(uint64_t key)
+{
+    return key >> (64 - MSD_BITS);
+}
+
+static inline unsigned int lsdDigit(uint64_t key, int pass)
+{
+    return (key >> (64 - SORTED_BITS + pass * LSD_BITS)) & (LSD_BUCKETS - 1);
+}
+
+static inline unsigned int chainDigit(const struct rainbow_chain *chain)
+{
+    return msdDigit(hashKey(chain->hash));
+}
+
+static inline void tileRange(struct chain_sorter *sorter, size_t tile,
+                             size_t *begin, size_t *end)
+{
+    *begin = sorter->count * tile / sorter->numTiles;
+    *end = sorter->count * (tile + 1) / sorter->numTiles;
+}
+
+// counts chains of a tile per partition
+static void histogramTiles(void *data, size_t begin, size_t end,
+                           unsigned int worker)
+{
+    struct chain_sorter *sorter = data;
+    size_t tile;
+
+    for (tile = begin; tile < end; ++tile) {
+        size_t *counts = sorter->tileCounts[tile];
+        size_t first, last, i;
+
+        memset(counts, 0, MSD_BUCKETS * sizeof(*counts));
+        tileRange(sorter, tile, &first, &last);
+
+        for (i = first; i < last; ++i)
+            ++counts[chainDigit(&sorter->chains[i])];
+    }
+}
+
+// moves chains to their partitions in place; every chain taken out of
+// a partition is swapped with the one at the next free place of its own
+// partition until a chain of the current partition comes back, so writes
+// go to MSD_BUCKETS sequential streams
+static void partitionChains(struct chain_sorter *sorter)
+{
+    struct rainbow_chain *chains = sorter->chains;
+    size_t next[MSD_BUCKETS];
+    unsigned int bucket;
+
+    memcpy(next, sorter->bucketStart, sizeof(next));
+
+    for (bucket = 0; bucket < MSD_BUCKETS; ++bucket) {
+        size_t end = sorter->bucketStart[bucket + 1];
+
+        while (next[bucket] < end) {
+            struct rainbow_chain chain = chains[next[bucket]];
+            unsigned int digit = chainDigit(&chain);
+
+            while (digit != bucket) {
+                struct rainbow_chain swap = chains[next[digit]];
+
+                chains[next[digit]++] = chain;
+                chain = swap;
+                digit = chainDigit(&chain);
+            }
+            chains[next[bucket]++] = chain;
+        }
+    }
+}
+
+// orders pairs with equal sorted key bits by full hash
+static void sortTies(const struct rainbow_chain *chains,
+                     struct sort_entry *entries, size_t count)
+{
+    size_t i, j;
+
+    for (i = 0; i < count; i = j) {
+        uint64_t prefix = entries[i].key >> (64 - SORTED_BITS);
+
+        for (j = i + 1; j < count; ++j) {
+            if (entries[j].key >> (64 - SORTED_BITS) != prefix)
+                break;
+        }
+
+        if (j - i > 1) {
+            size_t k, l;
+
+            for (k = i + 1; k < j; ++k) {
+                struct sort_entry entry = entries[k];
+                const unsigned int *hash = chains[entry.index].hash;
+
+                for (l = k; l > i; --l) {
+                    const struct rainbow_chain *prev =
+                                    &chains[entries[l - 1].index];
+
+                    if (memcmp(prev->hash, hash, sizeof(hash_t)) <= 0)
+                        break;
+                    entries[l] = entries[l - 1];
+                }
+                entries[l] = entry;
+            }
+        }
+    }
+}
+
+// moves chains of a partition to their sorted positions by following
+// cycles of the permutation; position i takes chain order[i].index, and
+// positions already filled are marked by pointing them at themselves
+static void permuteChains(struct rainbow_chain *chains,
+                          struct sort_entry *order, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        struct rainbow_chain first;
+        size_t hole, next;
+
+        if (order[i].index == i)
+            continue;
+
+        first = chains[i];
+        for (hole = i; (next = order[hole].index) != i; hole = next) {
+            chains[hole] = chains[next];
+            order[hole].index = hole;
+        }
+        chains[hole] = first;
+        order[hole].index = hole;
+    }
+}
+
+// sorts partitions by LSD passes over their pairs, then permutes their
+// chains
+static void sortPartitions(void *data, size_t begin, size_t end,
+                           unsigned int worker)
+{
+    struct chain_sorter *sorter = data;
+    struct sort_worker *self = &sorter->workers[worker];
+    uint32_t (*counts)[LSD_BUCKETS] = self->counts;
+    size_t bucket;
+
+    for (bucket = begin; bucket < end; ++bucket) {
+        size_t first = sorter->bucketStart[bucket];
+        size_t count = sorter->bucketStart[bucket + 1] - first;
+        struct rainbow_chain *chains = &sorter->chains[first];
+        struct sort_entry *src, *dst;
+        size_t i;
+        int pass;
+
+        if (count < 2)
+            continue;
+
+        if (self->capacity < count) {
+            free(self->entries);
+            free(self->tmp);
+            self->entries = malloc(count * sizeof(*self->entries));
+            assert(self->entries);
+            self->tmp = malloc(count * sizeof(*self->tmp));
+            assert(self->tmp);
+            self->capacity = count;
+        }
+        src = self->entries;
+        dst = self->tmp;
+
+        // pairs and histograms of all passes at once
+        memset(counts, 0, LSD_PASSES * sizeof(*counts));
+        for (i = 0; i < count; ++i) {
+            src[i].key = hashKey(chains[i].hash);
+            src[i].index = i;
+            for (pass = 0; pass < LSD_PASSES; ++pass)
+                ++counts[pass][lsdDigit(src[i].key, pass)];
+        }
+
+        for (pass = 0; pass < LSD_PASSES; ++pass) {
+            uint32_t offset = 0;
+            struct sort_entry *swap;
+            unsigned int digit;
+
+            // all pairs share this digit, nothing to do
+            if (counts[pass][lsdDigit(src[0].key, pass)] == count)
+                continue;
+
+            for (digit = 0; digit < LSD_BUCKETS; ++digit) {
+                uint32_t n = counts[pass][digit];
+
+                counts[pass][digit] = offset;
+                offset += n;
+            }
+
+            for (i = 0; i < count; ++i)
+                dst[counts[pass][lsdDigit(src[i].key, pass)]++] = src[i];
+
+            swap = src;
+            src = dst;
+            dst = swap;
+        }
+
+        sortTies(chains, src, count);
+        permuteChains(chains, src, count);
+    }
+}
+
+struct chain_sorter *chainSorterCreate(struct thread_pool *pool,
+                                       size_t maxChains)
+{
+    struct chain_sorter *sorter;
+
+    assert(maxChains <= UINT32_MAX);
+
+    sorter = calloc(1, sizeof(*sorter));
+    assert(sorter);
+
+    sorter->pool = pool;
+    sorter->maxChains = maxChains;
+    sorter->numTiles = threadPoolSize(pool) * TILES_PER_THREAD;
+
+    sorter->tileCounts = malloc(sorter->numTiles
+                                        * sizeof(*sorter->tileCounts));
+    assert(sorter->tileCounts);
+    sorter->workers = calloc(threadPoolSize(pool), sizeof(*sorter->workers));
+    assert(sorter->workers);
+
+    return sorter;
+}
+
+void chainSorterDestroy(struct chain_sorter *sorter)
+{
+    unsigned int i;
+
+    for (i = 0; i < threadPoolSize(sorter->pool); ++i) {
+        free(sorter->workers[i].entries);
+        free(sorter->workers[i].tmp);
+    }
+    free(sorter->workers);
+    free(sorter->tileCounts);
+    free(sorter);
+}
+
+struct rainbow_chain *chainSort(struct chain_sorter *sorter,
+                                struct rainbow_chain *chains, size_t count)
+{
+    size_t offset = 0;
+    unsigned int bucket, tile;
+
+    assert(count <= sorter->maxChains);
+
+    sorter->chains = chains;
+    sorter->count = count;
+
+    threadPoolFor(sorter->pool, sorter->numTiles, 1,
+                  histogramTiles, sorter);
+
+    for (bucket = 0; bucket < MSD_BUCKETS; ++bucket) {
+        sorter->bucketStart[bucket] = offset;
+        for (tile = 0; tile < sorter->numTiles; ++tile)
+            offset += sorter->tileCounts[tile][bucket];
+    }
+    sorter->bucketStart[MSD_BUCKETS] = offset;
+
+    partitionChains(sorter);
+    threadPoolFor(sorter->pool, MSD_BUCKETS, 1, sortPartitions, sorter);
+
+    return chains;
+}
@@ -0,0 +1,22 @@
+#ifndef _CHAIN_SORT_H
+#define _CHAIN_SORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rainbow_chain.h"
+#include "thread_pool.h"
+
+struct chain_sorter;
+
+// creates a sorter for blocks of up to maxChains chains
+struct chain_sorter *chainSorterCreate(struct thread_pool *pool,
+                                       size_t maxChains);
+void chainSorterDestroy(struct chain_sorter *sorter);
+
+// sorts chains in place by end-point hash using a parallel radix sort of
+// (key, index) pairs, then a permutation of the chains; returns chains
+struct rainbow_chain *chainSort(struct chain_sorter *sorter,
+                                struct rainbow_chain *chains, size_t count);
+
+#endif
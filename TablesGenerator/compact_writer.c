@@ -0,0 +1,77 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "compact_writer.h"
+#include "merge.h"
+
+void compactTableWrite(const char *sortedPath, const char *path,
+                       const struct table_header *header,
+                       size_t bufferSize)
+{
+    struct rainbow_chain *chains;
+    uint8_t *rows;
+    size_t capacity;
+    uint64_t done = 0;
+    off_t outOffset = header->headerSize;
+    struct stat st;
+    int in, out;
+
+    in = open(sortedPath, O_RDONLY);
+    if (in < 0) {
+        perror("Error opening sorted table");
+        exit(1);
+    }
+
+    if (fstat(in, &st)
+        || (uint64_t)st.st_size != header->numberOfChains * sizeof(*chains)) {
+        fprintf(stderr, "Sorted table %s has unexpected size\n", sortedPath);
+        exit(1);
+    }
+
+    out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        perror("Error opening table");
+        exit(1);
+    }
+
+    capacity = bufferSize / sizeof(*chains);
+    if (!capacity)
+        capacity = 1;
+
+    chains = malloc(capacity * sizeof(*chains));
+    assert(chains);
+    rows = malloc(capacity * header->rowBytes);
+    assert(rows);
+
+    while (done < header->numberOfChains) {
+        size_t count = capacity;
+        size_t i;
+
+        if (count > header->numberOfChains - done)
+            count = header->numberOfChains - done;
+
+        chainsRead(in, chains, count, done * sizeof(*chains));
+
+        for (i = 0; i < count; ++i)
+            compactRowPack(&rows[i * header->rowBytes], header,
+                           compactGetIndex(&chains[i]),
+                           compactEndKey(header, chains[i].hash));
+
+        writeFully(out, rows, count * header->rowBytes, outOffset);
+        outOffset += count * header->rowBytes;
+        done += count;
+    }
+
+    // header goes last, so that an interrupted conversion leaves no table
+    // which looks complete
+    writeFully(out, header, sizeof(*header), 0);
+
+    free(rows);
+    free(chains);
+    close(out);
+    close(in);
+}
@@ -0,0 +1,30 @@
+#ifndef _COMPACT_WRITER_H
+#define _COMPACT_WRITER_H
+
+#include <stddef.h>
+
+#include "compact_table.h"
+
+// converts the sorted table of chains at sortedPath, whose password fields
+// hold start indices, into a compact table at path, reading and writing
+// through a buffer of bufferSize bytes
+void compactTableWrite(const char *sortedPath, const char *path,
+                       const struct table_header *header,
+                       size_t bufferSize);
+
+// stores start index in the password field of a chain and reads it back
+static inline void compactSetIndex(struct rainbow_chain *chain, uint64_t index)
+{
+    memset(chain->password, 0, sizeof(chain->password));
+    memcpy(chain->password, &index, sizeof(index));
+}
+
+static inline uint64_t compactGetIndex(const struct rainbow_chain *chain)
+{
+    uint64_t index;
+
+    memcpy(&index, chain->password, sizeof(index));
+    return index;
+}
+
+#endif
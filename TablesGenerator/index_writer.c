@@ -0,0 +1,81 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "index_writer.h"
+#include "merge.h"
+
+struct index_builder {
+    uint32_t bits;
+    // chains in every bucket, turned into offsets when written; one more
+    // entry for the end of the last bucket
+    uint64_t *counts;
+};
+
+struct index_builder *indexBuilderCreate(uint32_t bits)
+{
+    struct index_builder *builder;
+
+    assert(bits > 0 && bits <= TABLE_INDEX_MAX_BITS);
+
+    builder = malloc(sizeof(*builder));
+    assert(builder);
+
+    builder->bits = bits;
+    builder->counts = calloc(((size_t)1 << bits) + 1,
+                             sizeof(*builder->counts));
+    assert(builder->counts);
+
+    return builder;
+}
+
+void indexBuilderDestroy(struct index_builder *builder)
+{
+    free(builder->counts);
+    free(builder);
+}
+
+void indexBuilderAdd(struct index_builder *builder,
+                     const struct rainbow_chain *chains, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; ++i)
+        __atomic_fetch_add(&builder->counts[tableIndexBucket(builder->bits,
+                                                             chains[i].hash)],
+                           1, __ATOMIC_RELAXED);
+}
+
+void indexBuilderWrite(struct index_builder *builder,
+                       const struct table_header *header, const char *path)
+{
+    size_t numBuckets = (size_t)1 << builder->bits;
+    struct table_index_header index;
+    uint64_t offset = 0;
+    size_t b;
+    int fd;
+
+    // counts to first rows of buckets
+    for (b = 0; b <= numBuckets; ++b) {
+        uint64_t count = builder->counts[b];
+
+        builder->counts[b] = offset;
+        offset += count;
+    }
+    assert(builder->counts[numBuckets] == header->numberOfChains);
+
+    tableIndexHeaderInit(&index, header, builder->bits);
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Error opening index");
+        exit(1);
+    }
+
+    writeFully(fd, &index, sizeof(index), 0);
+    writeFully(fd, builder->counts, (numBuckets + 1) * sizeof(uint64_t),
+               sizeof(index));
+    close(fd);
+}
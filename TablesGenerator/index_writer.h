@@ -0,0 +1,26 @@
+#ifndef _INDEX_WRITER_H
+#define _INDEX_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rainbow_chain.h"
+#include "table_index.h"
+
+// bucket sizes of a table index, counted as blocks are saved; they do not
+// depend on the order of rows, so the index needs no pass over the table
+struct index_builder;
+
+struct index_builder *indexBuilderCreate(uint32_t bits);
+void indexBuilderDestroy(struct index_builder *builder);
+
+// counts chains of a block into their buckets; may be called from several
+// threads
+void indexBuilderAdd(struct index_builder *builder,
+                     const struct rainbow_chain *chains, size_t count);
+
+// writes the index of the table described by header to path
+void indexBuilderWrite(struct index_builder *builder,
+                       const struct table_header *header, const char *path);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef _KERNEL_SOURCE_H
+#define _KERNEL_SOURCE_H
+
+#include <stddef.h>
+
+// rainbow.cl with its includes inlined, embedded into the executable at
+// build time by cmake/EmbedKernel.cmake
+extern const char rainbowKernelSource[];
+extern const size_t rainbowKernelSize;
+
+#endif
@@ -1,14 +1,29 @@
 #include <assert.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
+#include "bucket_store.h"
+#include "chain_simd.h"
+#include "chain_sort.h"
+#include "compact_writer.h"
+#include "index_writer.h"
 #include "config.h"
 #include "md5.h"
+#include "merge.h"
+#include "mph_writer.h"
+#include "philox.h"
 #include "rainbow_chain.h"
+#include "run_store.h"
+#include "table_header.h"
+#include "thread_pool.h"
 #include "utils.h"
+#include "work_queue.h"
 
 #define SFMT_MEXP 19937
 #include "SFMT.h"
@@ -16,19 +31,52 @@
 #define DIV_ROUND_UP(dividend, divisor) \
     (((dividend) + (divisor) - 1) / (divisor))
 
-#if OPENMP_MODE
-#warning Compiling in OpenMP mode...
-#endif
+#ifdef HAVE_OPENCL
+#include <CL/cl.h>
 
-#if CILK_MODE
-#warning Compiling in Cilk+ mode...
-#include <cilk/cilk.h>
+#include "kernel_source.h"
+#include "program_cache.h"
 #endif
 
-#if OPENCL_MODE
-#warning Compiling in OpenCL mode...
-#include <CL/cl.h>
-#endif
+// default sizes of merge buffers, in KiB
+#define DEFAULT_MERGE_BUFFER    1024
+#define DEFAULT_WRITE_BUFFER    16384
+
+// default number of blocks in flight on the OpenCL device and of host
+// threads preparing and saving them
+#define DEFAULT_PIPELINE_DEPTH  4
+#define DEFAULT_PRODUCERS       1
+#define DEFAULT_CONSUMERS       2
+
+// --platform all, --device all
+#define OPENCL_ALL              -1
+// --sub-devices numa
+#define SUB_DEVICES_NUMA        UINT32_MAX
+
+// number of chains a CPU worker takes at a time
+#define CPU_CHAINS_PER_TASK     64
+
+// blocks prepared for the CPU in hybrid mode, one generated while the
+// next one is prepared
+#define CPU_SLOTS               2
+// part of the threads sorting device blocks in hybrid mode, the rest
+// generate blocks on the CPU; one pool serializes its callers, so sharing
+// it would stall the devices while the CPU generates a block
+#define HYBRID_SORT_SHARE       4
+
+enum start_points {
+    // SFMT generated on the host and uploaded to the device
+    START_RANDOM,
+    // derived from the seed and chain index, on the device in OpenCL mode
+    START_PHILOX,
+};
+
+enum engine {
+    ENGINE_CPU,
+    ENGINE_OPENCL,
+    // OpenCL devices and CPU threads generating blocks together
+    ENGINE_HYBRID,
+};
 
 struct args {
     uint32_t chainsInBlock;
@@ -36,129 +84,191 @@ struct args {
     uint32_t passwordLength;
     uint32_t numberOfChains;
     uint32_t showDist;
+    enum engine engine;
+    uint32_t threads;
+    const char *simd;
+    // read-ahead buffer of every merged block and output buffer, in KiB
+    uint32_t mergeBuffer;
+    uint32_t writeBuffer;
+    // maximum number of runs merged at once
+    uint32_t fanIn;
+    // keep sorted blocks in one preallocated file
+    uint32_t runFile;
+    // memory for sorted blocks before they are spilled to disk, in MiB
+    uint32_t memoryBudget;
+    // number of runs merged into one by the background merger
+    uint32_t mergeFactor;
+    // distribute chains into 2^buckets files instead of sorted runs
+    uint32_t buckets;
+    // number of blocks in flight on the OpenCL device
+    uint32_t pipelineDepth;
+    // threads generating start points and saving blocks in OpenCL mode
+    uint32_t producers;
+    uint32_t consumers;
+    // OpenCL platform and device index, or OPENCL_ALL
+    int32_t platform;
+    int32_t device;
+    // split every device into this many sub-devices, or by NUMA node
+    uint32_t subDevices;
+    // directory of cached OpenCL program binaries, default one if NULL
+    const char *cacheDir;
+    uint32_t noCache;
+    enum start_points startPoints;
+    // seed of start points, current time if not set
+    uint64_t seed;
+    uint32_t seedSet;
+    // write a compact table of start indices and truncated end-points
+    uint32_t compact;
+    // end-point bits of compact rows, 0 for default
+    uint32_t endBits;
+    // bucket bits of the .idx sidecar, 0 for default
+    uint32_t indexBits;
+    uint32_t noIndex;
+    // write the .mph perfect hash of end-points
+    uint32_t mph;
+    uint32_t mphFingerprintBits;
 };
 
+static uint64_t seed;
 static sfmt_t sfmt;
-
-static inline void blockFileName(char *out, struct args *args,
-                                 uint32_t blockNumber)
-{
-    sprintf(out, "rainbow-len%u-%03u.tmp",
-            args->passwordLength, blockNumber);
-}
+static struct thread_pool *pool;
+static const struct chain_simd *chainSimd;
+static chain_simd_fn chainGenerate;
+static struct run_store *runStore;
+static struct bucket_store *bucketStore;
+static struct index_builder *indexBuilder;
 
 static inline void outFileName(char *out, struct args *args)
 {
-    sprintf(out, "rainbow-len%u.tbl", args->passwordLength);
-}
-
-// stores one rainbow table row into file
-static void storeTableChains(struct args *args, struct rainbow_chain *chain,
-                             uint32_t blockNumber)
-{
-    char filename[256];
-
-    blockFileName(filename, args, blockNumber);
-
-    FILE* file = fopen(filename, "wb");
-    if(!file)
-    {
-        perror("Error opening file");
-        exit(1);
-    }
-
-    fwrite(chain, sizeof(*chain), args->chainsInBlock, file);
-    fclose(file);
+    sprintf(out, "rainbow-len%u.%s", args->passwordLength,
+            args->compact ? "ctbl" : "tbl");
 }
 
 static uint32_t charsetStats[CHARSET_SIZE];
 
 // generates random string with up to MAX_PASSWD length
-static void randomString(char* out, size_t length)
+static void randomString(sfmt_t *rng, char* out, size_t length, int stats)
 {
     while(length-- > 0)
     {
-        uint32_t random = sfmt_genrand_uint32(&sfmt);
+        uint32_t random = sfmt_genrand_uint32(rng);
         size_t index = (size_t) ((double)CHARSET_SIZE * random / UINT_MAX);
 
         if (index >= CHARSET_SIZE)
             index = CHARSET_SIZE - 1;
 
         *out++ = charset[index];
-        ++charsetStats[index];
+        // blocks may be prepared by several producer threads
+        if (stats)
+            __atomic_fetch_add(&charsetStats[index], 1, __ATOMIC_RELAXED);
     }
-
-    *out = '\0';
 }
 
-// generates initial password for a block of rainbow chains
-static void prepareBlock(struct args *args, struct rainbow_chain *chains)
+// generates initial password for a block of rainbow chains; Philox start
+// points depend only on the block number, so rng may be NULL for them
+static void prepareBlock(struct args *args, sfmt_t *rng,
+                         struct rainbow_chain *chains, uint32_t blockNumber)
 {
+    uint64_t firstChain = (uint64_t)blockNumber * args->chainsInBlock;
     int i;
 
     for (i = 0; i < args->chainsInBlock; ++i)
     {
-        randomString(chains[i].password, args->passwordLength);
+        memset(chains[i].password, 0, sizeof(chains[i].password));
+        if (args->startPoints == START_PHILOX)
+            philoxPassword(chains[i].password, args->passwordLength, seed,
+                           firstChain + i);
+        else
+            randomString(rng, chains[i].password, args->passwordLength,
+                         args->showDist);
     }
 }
 
-#if !OPENCL_MODE
-// generates one rainbow table chain, results in ont rainbow table row
-static void generateRainbowTableChain(struct args *args,
-                                      struct rainbow_chain *chain)
+// generates up to CPU_CHAINS_PER_TASK rainbow table chains in lockstep,
+// results in count rainbow table rows
+static void generateRainbowTableChains(struct args *args,
+                                       struct rainbow_chain *chains,
+                                       size_t count)
 {
-    password_t chainPassword;
-    hash_t passwordHash;
+    password_t passwords[CPU_CHAINS_PER_TASK] = { { 0 } };
+    hash_t hashes[CPU_CHAINS_PER_TASK];
+    size_t j;
     int i;
 
-    strcpy(chainPassword, chain->password);
+    assert(count <= CPU_CHAINS_PER_TASK);
 
-    for(i = 0; i < args->chainLength; ++i)
-    {
-        hash(passwordHash, chainPassword);
-        reduce(chainPassword, passwordHash, args->passwordLength, i);
+    for (j = 0; j < count; ++j)
+        memcpy(passwords[j], chains[j].password, sizeof(password_t));
+
+    for (i = 0; i < args->chainLength; ++i) {
+        md5_batch(passwords, args->passwordLength, sizeof(*passwords),
+                  count, hashes[0]);
+
+        for (j = 0; j < count; ++j)
+            reduce(passwords[j], hashes[j], args->passwordLength, i);
     }
-    hash(passwordHash, chainPassword);
+    md5_batch(passwords, args->passwordLength, sizeof(*passwords),
+              count, hashes[0]);
 
-    memcpy(chain->hash, passwordHash, sizeof(passwordHash));
+    for (j = 0; j < count; ++j)
+        memcpy(chains[j].hash, hashes[j], sizeof(hash_t));
 }
 
-// generates all rainbow chains in a block of rainbow chains
-static void processBlock(struct args *args, struct rainbow_chain *chains)
-{
-    int i;
+struct cpu_job {
+    struct args *args;
+    struct rainbow_chain *chains;
+};
 
-#if OPENMP_MODE
-    #pragma omp parallel for
-    for(i = 0; i < args->chainsInBlock; ++i)
-#elif CILK_MODE
-    cilk_for (i = 0; i < args->chainsInBlock; ++i)
-#elif OPENACC_MODE
-    #pragma acc kernels
-    for(i = 0; i < args->chainsInBlock; ++i)
-#else
-    for(i = 0; i < args->chainsInBlock; ++i)
-#endif
-    {
-        generateRainbowTableChain(args, &chains[i]);
-    }
+// generates a range of rainbow chains on one CPU worker
+static void processChains(void *data, size_t begin, size_t end,
+                          unsigned int worker)
+{
+    struct cpu_job *job = data;
+
+    // reduction statistics are only collected by the reference code
+    if (!job->args->showDist)
+        chainGenerate(&job->chains[begin], end - begin,
+                      job->args->chainLength);
+    else
+        generateRainbowTableChains(job->args, &job->chains[begin],
+                                   end - begin);
 }
-#endif
 
-static int chainCompare(const void *a, const void *b)
+// generates all rainbow chains in a block of rainbow chains on workers
+static void processBlock(struct args *args, struct thread_pool *workers,
+                         struct rainbow_chain *chains)
 {
-    const struct rainbow_chain *ca = a;
-    const struct rainbow_chain *cb = b;
+    struct cpu_job job = { args, chains };
 
-    return memcmp(ca->hash, cb->hash, sizeof(ca->hash));
+    threadPoolFor(workers, args->chainsInBlock, CPU_CHAINS_PER_TASK,
+                  processChains, &job);
 }
 
-// saves a block of random chains to file
-static void saveBlock(struct args *args, struct rainbow_chain *chains,
-                      uint32_t blockNumber)
+// saves a block of random chains to file, sorted with given sorter
+static void saveBlock(struct args *args, struct chain_sorter *blockSorter,
+                      struct rainbow_chain *chains, uint32_t blockNumber)
 {
-    qsort(chains, args->chainsInBlock, sizeof(*chains), chainCompare);
-    storeTableChains(args, chains, blockNumber);
+    uint64_t firstChain = (uint64_t)blockNumber * args->chainsInBlock;
+    struct rainbow_chain *sorted;
+    int i;
+
+    // compact tables do not store passwords, the start index takes their
+    // place until the table is written
+    if (args->compact) {
+        for (i = 0; i < args->chainsInBlock; ++i)
+            compactSetIndex(&chains[i], firstChain + i);
+    }
+
+    if (indexBuilder)
+        indexBuilderAdd(indexBuilder, chains, args->chainsInBlock);
+
+    if (bucketStore) {
+        bucketStoreAdd(bucketStore, chains, args->chainsInBlock);
+        return;
+    }
+
+    sorted = chainSort(blockSorter, chains, args->chainsInBlock);
+    runStoreAdd(runStore, blockNumber, sorted, args->chainsInBlock);
 }
 
 static void parseArgs(struct args *args, int argc, char **argv)
@@ -198,215 +308,663 @@ static void parseArgs(struct args *args, int argc, char **argv)
         } else if (!strcmp(argv[i], "-d")) {
             args->showDist = 1;
             continue;
+        } else if (!strcmp(argv[i], "--engine")) {
+            if (i == argc - 1)
+                goto show_usage;
+            if (!strcmp(argv[i + 1], "cpu")) {
+                args->engine = ENGINE_CPU;
+            } else if (!strcmp(argv[i + 1], "opencl")) {
+#ifndef HAVE_OPENCL
+                fprintf(stderr, "OpenCL engine is not available "
+                                "in this build\n");
+                exit(1);
+#endif
+                args->engine = ENGINE_OPENCL;
+            } else if (!strcmp(argv[i + 1], "hybrid")) {
+#ifndef HAVE_OPENCL
+                fprintf(stderr, "OpenCL engine is not available "
+                                "in this build\n");
+                exit(1);
+#endif
+                args->engine = ENGINE_HYBRID;
+            } else {
+                goto show_usage;
+            }
+            ++i;
+            continue;
+        } else if (!strcmp(argv[i], "--threads")) {
+            if (i == argc - 1)
+                goto show_usage;
+            args->threads = atoi(argv[i + 1]);
+            ++i;
+            continue;
+        } else if (!strcmp(argv[i], "--simd")) {
+            if (i == argc - 1)
+                goto show_usage;
+            args->simd = argv[i + 1];
+            ++i;
+            continue;
+        } else if (!strcmp(argv[i], "--merge-buffer")) {
+            if (i == argc - 1)
+                goto show_usage;
+            args->mergeBuffer = atoi(argv[i + 1]);
+            ++i;
+            continue;
+        } else if (!strcmp(argv[i], "--write-buffer")) {
+            if (i == argc - 1)
+                goto show_usage;
+            args->writeBuffer = atoi(argv[i + 1]);
+            ++i;
+            continue;
+        } else if (!strcmp(argv[i], "--fan-in")) {
+            if (i == argc - 1)
+                goto show_usage;
+            args->fanIn = atoi(argv[i + 1]);
+            ++i;
+            continue;
+        } else if (!strcmp(argv[i], "--run-file")) {
+            args->runFile = 1;
+            continue;
+        } else if (!strcmp(argv[i], "--memory-budget")) {
+            if (i == argc - 1)
+                goto show_usage;
+            args->memoryBudget = atoi(argv[i + 1]);
+            ++i;
+            continue;
+        } else if (!strcmp(argv[i], "--merge-factor")) {
+            if (i == argc - 1)
+                goto show_usage;
+            args->mergeFactor = atoi(argv[i + 1]);
+            ++i;
+            continue;
+        } else if (!strcmp(argv[i], "--pipeline-depth")) {
+            if (i == argc - 1)
+                goto show_usage;
+            args->pipelineDepth = atoi(argv[i + 1]);
+            if (!args->pipelineDepth)
+                goto show_usage;
+            ++i;
+            continue;
+        } else if (!strcmp(argv[i], "--producers")) {
+            if (i == argc - 1)
+                goto show_usage;
+            args->producers = atoi(argv[i + 1]);
+            if (!args->producers)
+                goto show_usage;
+            ++i;
+            continue;
+        } else if (!strcmp(argv[i], "--consumers")) {
+            if (i == argc - 1)
+                goto show_usage;
+            args->consumers = atoi(argv[i + 1]);
+            if (!args->consumers)
+                goto show_usage;
+            ++i;
+            continue;
+        } else if (!strcmp(argv[i], "--platform")) {
+            if (i == argc - 1)
+                goto show_usage;
+            if (!strcmp(argv[i + 1], "all"))
+                args->platform = OPENCL_ALL;
+            else
+                args->platform = atoi(argv[i + 1]);
+            if (args->platform < OPENCL_ALL)
+                goto show_usage;
+            ++i;
+            continue;
+        } else if (!strcmp(argv[i], "--device")) {
+            if (i == argc - 1)
+                goto show_usage;
+            if (!strcmp(argv[i + 1], "all"))
+                args->device = OPENCL_ALL;
+            else
+                args->device = atoi(argv[i + 1]);
+            if (args->device < OPENCL_ALL)
+                goto show_usage;
+            ++i;
+            continue;
+        } else if (!strcmp(argv[i], "--sub-devices")) {
+            if (i == argc - 1)
+                goto show_usage;
+            if (!strcmp(argv[i + 1], "numa"))
+                args->subDevices = SUB_DEVICES_NUMA;
+            else
+                args->subDevices = atoi(argv[i + 1]);
+            ++i;
+            continue;
+        } else if (!strcmp(argv[i], "--cache-dir")) {
+            if (i == argc - 1)
+                goto show_usage;
+            args->cacheDir = argv[i + 1];
+            ++i;
+            continue;
+        } else if (!strcmp(argv[i], "--no-cache")) {
+            args->noCache = 1;
+            continue;
+        } else if (!strcmp(argv[i], "--start-points")) {
+            if (i == argc - 1)
+                goto show_usage;
+            if (!strcmp(argv[i + 1], "random"))
+                args->startPoints = START_RANDOM;
+            else if (!strcmp(argv[i + 1], "philox"))
+                args->startPoints = START_PHILOX;
+            else
+                goto show_usage;
+            ++i;
+            continue;
+        } else if (!strcmp(argv[i], "--seed")) {
+            if (i == argc - 1)
+                goto show_usage;
+            args->seed = strtoull(argv[i + 1], NULL, 0);
+            args->seedSet = 1;
+            ++i;
+            continue;
+        } else if (!strcmp(argv[i], "--compact")) {
+            args->compact = 1;
+            continue;
+        } else if (!strcmp(argv[i], "--end-bits")) {
+            if (i == argc - 1)
+                goto show_usage;
+            args->endBits = atoi(argv[i + 1]);
+            if (!args->endBits || args->endBits > 64)
+                goto show_usage;
+            ++i;
+            continue;
+        } else if (!strcmp(argv[i], "--index-bits")) {
+            if (i == argc - 1)
+                goto show_usage;
+            args->indexBits = atoi(argv[i + 1]);
+            if (!args->indexBits || args->indexBits > TABLE_INDEX_MAX_BITS)
+                goto show_usage;
+            ++i;
+            continue;
+        } else if (!strcmp(argv[i], "--no-index")) {
+            args->noIndex = 1;
+            continue;
+        } else if (!strcmp(argv[i], "--mph")) {
+            args->mph = 1;
+            continue;
+        } else if (!strcmp(argv[i], "--mph-fingerprint-bits")) {
+            if (i == argc - 1)
+                goto show_usage;
+            args->mphFingerprintBits = atoi(argv[i + 1]);
+            if (!args->mphFingerprintBits
+                || args->mphFingerprintBits > TABLE_MPH_MAX_FINGERPRINT_BITS)
+                goto show_usage;
+            ++i;
+            continue;
+        } else if (!strcmp(argv[i], "--buckets")) {
+            if (i == argc - 1)
+                goto show_usage;
+            args->buckets = atoi(argv[i + 1]);
+            if (args->buckets > 16)
+                goto show_usage;
+            ++i;
+            continue;
         }
     }
 
+    // start points of compact tables are derived from their index
+    if (args->compact)
+        args->startPoints = START_PHILOX;
+
     if (set == 0xf)
         return;
 
 show_usage:
     fprintf(stderr,
             "%s -l password_length -n number_of_chains "
-            "-c chain_length -b chains_in_block\n",
+            "-c chain_length -b chains_in_block [-d] "
+            "[--engine cpu|opencl|hybrid] [--threads N] "
+            "[--simd avx512|avx2|sse2|scalar] "
+            "[--merge-buffer KiB] [--write-buffer KiB] [--fan-in N] "
+            "[--run-file] [--memory-budget MiB] [--merge-factor N] "
+            "[--buckets BITS] [--pipeline-depth N] [--producers N] "
+            "[--consumers N] [--platform N|all] [--device N|all] "
+            "[--sub-devices N|numa] [--cache-dir DIR] [--no-cache] "
+            "[--start-points random|philox] [--seed N] [--compact] "
+            "[--end-bits N] [--index-bits N] [--no-index] [--mph] "
+            "[--mph-fingerprint-bits N]\n",
             argv[0]);
     exit(1);
 }
 
-static void sortTables(struct args *args, uint32_t numberOfBlocks)
+static void sortTables(struct args *args)
 {
-    struct rainbow_chain *chains;
+    struct table_header header;
     char filename[256];
-    FILE **blocks;
-    FILE *out;
-    size_t ret;
-    int i;
-
-    chains = malloc(numberOfBlocks * sizeof(*chains));
-    assert(chains);
-
-    blocks = malloc(numberOfBlocks * sizeof(*blocks));
-    assert(blocks);
-
-    for (i = 0; i < numberOfBlocks; ++i) {
-        blockFileName(filename, args, i);
-        blocks[i] = fopen(filename, "rb");
-        assert(blocks[i]);
-
-        ret = fread(&chains[i], sizeof(*chains), 1, blocks[i]);
-        assert(ret == 1);
-    }
+    char sortedName[272];
+    char indexName[272];
+    char mphName[272];
+    int fd;
 
     outFileName(filename, args);
-    out = fopen(filename, "wb");
-    assert(out);
-
-    do {
-        int min = 0;
-
-        for (i = 0; i < numberOfBlocks; ++i) {
-            if (memcmp(chains[i].hash, chains[min].hash, sizeof(hash_t)) < 0)
-                min = i;
+    // compact tables are converted from a sorted table of full chains
+    sprintf(sortedName, "%s%s", filename, args->compact ? ".tmp" : "");
+
+    // chain tables are sorted in place after room for the header
+    if (bucketStore)
+        bucketStoreFinish(bucketStore, pool, sortedName,
+                          args->compact ? 0 : TABLE_HEADER_SIZE);
+    else
+        runStoreMerge(runStore, sortedName,
+                      args->compact ? 0 : TABLE_HEADER_SIZE);
+
+    if (!args->compact) {
+        tableHeaderInit(&header, TABLE_FORMAT_CHAINS, args->passwordLength,
+                        args->chainLength, args->numberOfChains);
+        header.seed = seed;
+        header.flags |= TABLE_FLAG_SORTED;
+
+        fd = open(filename, O_WRONLY);
+        if (fd < 0) {
+            perror("Error opening table");
+            exit(1);
         }
+        writeFully(fd, &header, sizeof(header), 0);
+        close(fd);
+    } else {
+        compactHeaderInit(&header, args->passwordLength, args->chainLength,
+                          seed, args->numberOfChains, args->endBits);
+        header.flags |= TABLE_FLAG_SORTED;
+        printf("Writing compact table, %u-byte rows of %u-bit start index "
+               "and %u-bit end-point...\n", header.rowBytes,
+               header.indexBits, header.endBits);
+        compactTableWrite(sortedName, filename, &header,
+                          (size_t)args->writeBuffer * 1024);
+        unlink(sortedName);
+    }
 
-        ret = fwrite(&chains[min], sizeof(*chains), 1, out);
-        assert(ret == 1);
+    // an index left by an earlier table of the same name would not match
+    sprintf(indexName, "%s.idx", filename);
+    if (!indexBuilder) {
+        unlink(indexName);
+    } else {
+        printf("Writing index %s of %u-bit buckets...\n", indexName,
+               args->indexBits);
+        indexBuilderWrite(indexBuilder, &header, indexName);
+    }
 
-        ret = fread(&chains[min], sizeof(*chains), 1, blocks[min]);
-        if (ret != 1) {
-            fclose(blocks[min]);
-            --numberOfBlocks;
-            blocks[min] = blocks[numberOfBlocks];
-            chains[min] = chains[numberOfBlocks];
-        }
-    } while (numberOfBlocks > 1);
+    sprintf(mphName, "%s.mph", filename);
+    if (!args->mph) {
+        unlink(mphName);
+    } else {
+        printf("Building perfect hash %s...\n", mphName);
+        tableMphWrite(filename, &header, mphName, args->mphFingerprintBits,
+                      pool);
+    }
+}
 
-    do {
-        ret = fwrite(&chains[0], sizeof(*chains), 1, out);
-        assert(ret == 1);
-    } while (fread(&chains[0], sizeof(*chains), 1, blocks[0]) == 1);
+#ifdef HAVE_OPENCL
+struct opencl_device;
+
+// one block in flight on the device; the upload, kernel and download of
+// a block are chained by events on separate queues, so that transfers of
+// one slot overlap with computation of another
+struct cl_slot {
+    // NULL for slots of blocks generated on the CPU in hybrid mode
+    struct opencl_device *device;
+    // kernel with arguments bound to buffers of this slot
+    cl_kernel kernel;
+    cl_mem inMem;
+    cl_mem outMem;
+    // pinned staging buffers, mapped for the whole run
+    cl_mem inPinned;
+    cl_mem outPinned;
+    uint8_t *inHost;
+    uint8_t *outHost;
+    // upload, kernel and download of the current block
+    cl_event events[3];
+    // start passwords of the block, hashes are added after download
+    struct rainbow_chain *chains;
+    uint32_t blockNumber;
+};
 
-    fclose(blocks[0]);
-    fclose(out);
-}
+// OpenCL device or sub-device with its own context, so that devices of
+// different platforms can be used together
+struct opencl_device {
+    cl_platform_id platformId;
+    cl_device_id deviceId;
+    // sub-devices are released with the device
+    int subDevice;
+    char name[128];
+    cl_context context;
+    cl_command_queue writeQueue;
+    cl_command_queue kernelQueue;
+    cl_command_queue readQueue;
+    cl_program program;
+    struct cl_slot *slots;
+    // blocks generated by the device
+    uint32_t blocks;
+};
 
-#if OPENCL_MODE
-static cl_context opencl_context;
-static cl_command_queue opencl_queue[2];
-static cl_program opencl_program;
-static cl_kernel opencl_kernel;
-static cl_mem opencl_in_mem[2];
-static cl_mem opencl_out_mem[2];
-static uint8_t *tmp_buf;
+static struct opencl_device *opencl_devices;
+static unsigned int opencl_num_devices;
+static struct cl_slot opencl_cpu_slots[CPU_SLOTS];
+// slots of blocks to generate on the CPU, NULL stops the CPU thread
+static struct work_queue *opencl_cpu_slots_queue;
+// slots pass from producers to the device thread to consumers and back;
+// free slots of all devices share one queue, so a device gets the next
+// block as soon as it finished one and faster devices take more blocks
+static struct work_queue *opencl_free_slots;
+static struct work_queue *opencl_prepared_slots;
+static struct work_queue *opencl_completed_slots;
 static int passwordSize;
 static int hashSize;
 
-// generates initial password for a block of rainbow chains
-static void prepareBlockCl(struct args *args, struct rainbow_chain *chains,
-                           int index)
+// generates initial passwords of a block into pinned memory of the slot
+static void prepareBlockCl(struct args *args, sfmt_t *rng,
+                           struct cl_slot *slot, uint32_t blockNumber)
 {
-    uint8_t *tmp = tmp_buf;
-    cl_int error;
+    uint8_t *tmp = slot->inHost;
     int i;
 
-    prepareBlock(args, chains);
+    slot->blockNumber = blockNumber;
+
+    // the device derives Philox start points itself
+    if (args->startPoints == START_PHILOX && slot->device)
+        return;
+
+    prepareBlock(args, rng, slot->chains, blockNumber);
+
+    if (!slot->device)
+        return;
 
     memset(tmp, 0, passwordSize * args->chainsInBlock);
 
     for (i = 0; i < args->chainsInBlock; ++i) {
-        memcpy(tmp, chains[i].password, args->passwordLength);
+        memcpy(tmp, slot->chains[i].password, args->passwordLength);
         tmp += passwordSize;
     }
+}
 
-    error = clEnqueueWriteBuffer(opencl_queue[index], opencl_in_mem[index],
-                                 CL_TRUE, 0, passwordSize * args->chainsInBlock,
-                                 tmp_buf, 0, NULL, NULL);
-    assert(error == CL_SUCCESS);
+// called by the OpenCL runtime when download of a block finished
+static void CL_CALLBACK blockDownloaded(cl_event event, cl_int status,
+                                        void *data)
+{
+    struct cl_slot *slot = data;
+
+    (void)event;
+    assert(status == CL_COMPLETE);
+
+    // never blocks, the queue has room for every slot
+    workQueuePush(opencl_completed_slots, slot);
 }
 
-// generates all rainbow chains in a block of rainbow chains
-static void processBlockCl(struct args *args, struct rainbow_chain *chains,
-                           int index)
+// enqueues upload, generation and download of a block without blocking
+static void processBlockCl(struct args *args, struct cl_slot *slot)
 {
 #ifdef USE_VECTORS
     const size_t globalWorkSize[] = { args->chainsInBlock / 4, 0, 0 };
 #else
     const size_t globalWorkSize[] = { args->chainsInBlock, 0, 0 };
 #endif
+    struct opencl_device *device = slot->device;
+    cl_ulong firstChain;
     cl_int error;
 
-    clSetKernelArg(opencl_kernel, 0, sizeof(cl_mem), &opencl_out_mem[index]);
-    clSetKernelArg(opencl_kernel, 1, sizeof(cl_mem), &opencl_in_mem[index]);
-    clSetKernelArg(opencl_kernel, 2, sizeof(*args), args);
+    if (args->startPoints == START_PHILOX) {
+        firstChain = (cl_ulong)slot->blockNumber * args->chainsInBlock;
+        clSetKernelArg(slot->kernel, 3, sizeof(firstChain), &firstChain);
+        slot->events[0] = NULL;
+    } else {
+        error = clEnqueueWriteBuffer(device->writeQueue, slot->inMem,
+                                     CL_FALSE, 0,
+                                     passwordSize * args->chainsInBlock,
+                                     slot->inHost, 0, NULL,
+                                     &slot->events[0]);
+        assert(error == CL_SUCCESS);
+    }
+
+    error = clEnqueueNDRangeKernel(device->kernelQueue, slot->kernel, 1, NULL,
+                                   globalWorkSize, NULL,
+                                   slot->events[0] ? 1 : 0,
+                                   slot->events[0] ? &slot->events[0] : NULL,
+                                   &slot->events[1]);
+    assert(error == CL_SUCCESS);
 
-    error = clEnqueueNDRangeKernel(opencl_queue[index], opencl_kernel, 1, NULL,
-                                   globalWorkSize, NULL, 0, NULL, NULL);
+    error = clEnqueueReadBuffer(device->readQueue, slot->outMem, CL_FALSE,
+                                0, hashSize * args->chainsInBlock,
+                                slot->outHost,
+                                1, &slot->events[1], &slot->events[2]);
     assert(error == CL_SUCCESS);
 
-    clFlush(opencl_queue[index]);
+    error = clSetEventCallback(slot->events[2], CL_COMPLETE,
+                               blockDownloaded, slot);
+    assert(error == CL_SUCCESS);
+
+    clFlush(device->writeQueue);
+    clFlush(device->kernelQueue);
+    clFlush(device->readQueue);
 }
 
-// makes sure that block processing finished
-static void finishBlockCl(int index)
+// releases events of a block whose download finished
+static void finishBlockCl(struct cl_slot *slot)
 {
-    clFinish(opencl_queue[index]);
+    int i;
+
+    if (!slot->device)
+        return;
+
+    for (i = 0; i < 3; ++i) {
+        if (slot->events[i])
+            clReleaseEvent(slot->events[i]);
+    }
 }
 
-// saves a block of random chains to file
-static void saveBlockCl(struct args *args, struct rainbow_chain *chains,
-                        uint32_t blockNumber, int index)
+// saves a downloaded block of random chains to file
+static void saveBlockCl(struct args *args, struct chain_sorter *blockSorter,
+                        struct cl_slot *slot)
 {
-    uint8_t *tmp = tmp_buf;
-    cl_int error;
+    uint8_t *tmp = slot->outHost;
     int i;
 
-    error = clEnqueueReadBuffer(opencl_queue[index], opencl_out_mem[index],
-                                CL_TRUE, 0, hashSize * args->chainsInBlock,
-                                tmp_buf, 0, NULL, NULL);
-    assert(error == CL_SUCCESS);
+    // start points generated on the device are reproduced from the seed
+    if (args->startPoints == START_PHILOX && !args->compact && slot->device)
+        prepareBlock(args, NULL, slot->chains, slot->blockNumber);
 
-    for (i = 0; i < args->chainsInBlock; ++i) {
-        memcpy(chains[i].hash, tmp, sizeof(chains->hash));
+    for (i = 0; slot->device && i < args->chainsInBlock; ++i) {
+        memcpy(slot->chains[i].hash, tmp, sizeof(slot->chains->hash));
         tmp += hashSize;
     }
 
-    saveBlock(args, chains, blockNumber);
+    saveBlock(args, blockSorter, slot->chains, slot->blockNumber);
 }
 
-static size_t loadKernel(char **retSrcBuf)
+// creates buffers and kernel of one pipeline slot of the device
+static cl_int createSlot(struct args *args, struct opencl_device *device,
+                         struct cl_slot *slot)
 {
-    char buf[4096];
-    FILE *source;
-    size_t ret;
-    size_t size = 0;
-    size_t srcBufSize = 4096;
-    char *srcBuf;
+    // layout of struct args in rainbow.cl
+    cl_uint kernelArgs[] = {
+        args->chainsInBlock,
+        args->chainLength,
+        args->passwordLength,
+        args->numberOfChains,
+        args->showDist,
+    };
+    size_t inSize = passwordSize * args->chainsInBlock;
+    size_t outSize = hashSize * args->chainsInBlock;
+    cl_ulong philoxSeed = seed;
+    cl_int error;
 
-    source = fopen("rainbow.cl", "rb");
-    if (!source) {
-        fprintf(stderr, "failed to open kernel source code (rainbow.cl)\n");
-        return 0;
+    slot->device = device;
+    slot->chains = calloc(args->chainsInBlock, sizeof(*slot->chains));
+    assert(slot->chains);
+
+    slot->outMem = clCreateBuffer(device->context, CL_MEM_WRITE_ONLY,
+                                  outSize, NULL, &error);
+    if (error != CL_SUCCESS)
+        return error;
+
+    slot->outPinned = clCreateBuffer(device->context,
+                                     CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                                     outSize, NULL, &error);
+    if (error != CL_SUCCESS)
+        return error;
+
+    slot->outHost = clEnqueueMapBuffer(device->readQueue, slot->outPinned,
+                                       CL_TRUE, CL_MAP_READ, 0, outSize,
+                                       0, NULL, NULL, &error);
+    if (error != CL_SUCCESS)
+        return error;
+
+    // Philox start points need no input buffers, the first chain of
+    // a block is set by processBlockCl
+    if (args->startPoints == START_PHILOX) {
+        slot->kernel = clCreateKernel(device->program, "rainbow_philox",
+                                      &error);
+        if (error != CL_SUCCESS)
+            return error;
+
+        clSetKernelArg(slot->kernel, 0, sizeof(cl_mem), &slot->outMem);
+        clSetKernelArg(slot->kernel, 1, sizeof(kernelArgs), kernelArgs);
+        clSetKernelArg(slot->kernel, 2, sizeof(philoxSeed), &philoxSeed);
+
+        return CL_SUCCESS;
     }
 
-    srcBuf = malloc(srcBufSize);
-    assert(srcBuf);
+    slot->inMem = clCreateBuffer(device->context, CL_MEM_READ_ONLY,
+                                 inSize, NULL, &error);
+    if (error != CL_SUCCESS)
+        return error;
+
+    slot->inPinned = clCreateBuffer(device->context,
+                                    CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                                    inSize, NULL, &error);
+    if (error != CL_SUCCESS)
+        return error;
+
+    slot->inHost = clEnqueueMapBuffer(device->writeQueue, slot->inPinned,
+                                      CL_TRUE, CL_MAP_WRITE, 0, inSize,
+                                      0, NULL, NULL, &error);
+    if (error != CL_SUCCESS)
+        return error;
+
+    slot->kernel = clCreateKernel(device->program, "rainbow", &error);
+    if (error != CL_SUCCESS)
+        return error;
+
+    clSetKernelArg(slot->kernel, 0, sizeof(cl_mem), &slot->outMem);
+    clSetKernelArg(slot->kernel, 1, sizeof(cl_mem), &slot->inMem);
+    clSetKernelArg(slot->kernel, 2, sizeof(kernelArgs), kernelArgs);
+
+    return CL_SUCCESS;
+}
+
+static void releaseSlot(struct cl_slot *slot)
+{
+    struct opencl_device *device = slot->device;
+
+    if (!device)
+        return;
+
+    if (slot->kernel)
+        clReleaseKernel(slot->kernel);
+    if (slot->outHost)
+        clEnqueueUnmapMemObject(device->readQueue, slot->outPinned,
+                                slot->outHost, 0, NULL, NULL);
+    if (slot->inHost)
+        clEnqueueUnmapMemObject(device->writeQueue, slot->inPinned,
+                                slot->inHost, 0, NULL, NULL);
+    clFinish(device->readQueue);
+    clFinish(device->writeQueue);
+    if (slot->outPinned)
+        clReleaseMemObject(slot->outPinned);
+    if (slot->inPinned)
+        clReleaseMemObject(slot->inPinned);
+    if (slot->outMem)
+        clReleaseMemObject(slot->outMem);
+    if (slot->inMem)
+        clReleaseMemObject(slot->inMem);
+    free(slot->chains);
+}
+
+// adds a device to the list of devices used for generation
+static void addDevice(cl_platform_id platformId, cl_device_id deviceId,
+                      int subDevice)
+{
+    struct opencl_device *device;
+
+    opencl_devices = realloc(opencl_devices,
+                             (opencl_num_devices + 1) * sizeof(*device));
+    assert(opencl_devices);
+
+    device = &opencl_devices[opencl_num_devices++];
+    memset(device, 0, sizeof(*device));
+    device->platformId = platformId;
+    device->deviceId = deviceId;
+    device->subDevice = subDevice;
+    clGetDeviceInfo(deviceId, CL_DEVICE_NAME, sizeof(device->name),
+                    device->name, NULL);
+}
+
+// adds the device, or its sub-devices if it should be split
+static int addSubDevices(struct args *args, cl_platform_id platformId,
+                         cl_device_id deviceId)
+{
+    cl_device_partition_property properties[3] = { 0, 0, 0 };
+    cl_device_id *subDevices;
+    cl_uint computeUnits = 0;
+    cl_uint count = 0;
+    cl_int error;
+    cl_uint i;
 
-    while (!feof(source)) {
-        ret = fread(buf, 1, sizeof(buf), source);
-        if (!ret)
-            break;
+    if (!args->subDevices) {
+        addDevice(platformId, deviceId, 0);
+        return 0;
+    }
 
-        if (size + ret > srcBufSize) {
-            srcBufSize *= 2;
-            srcBuf = realloc(srcBuf, srcBufSize);
-            assert(srcBuf);
+    if (args->subDevices == SUB_DEVICES_NUMA) {
+        properties[0] = CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN;
+        properties[1] = CL_DEVICE_AFFINITY_DOMAIN_NUMA;
+    } else {
+        clGetDeviceInfo(deviceId, CL_DEVICE_MAX_COMPUTE_UNITS,
+                        sizeof(computeUnits), &computeUnits, NULL);
+        if (computeUnits < args->subDevices) {
+            fprintf(stderr, "device has only %u compute units\n",
+                    computeUnits);
+            return -1;
         }
+        properties[0] = CL_DEVICE_PARTITION_EQUALLY;
+        properties[1] = computeUnits / args->subDevices;
+    }
 
-        memcpy(srcBuf + size, buf, ret);
-        size += ret;
+    error = clCreateSubDevices(deviceId, properties, 0, NULL, &count);
+    if (error != CL_SUCCESS) {
+        fprintf(stderr, "OpenCL error %d at %s:%d\n",
+                error, __FILE__, __LINE__);
+        return -1;
     }
 
-    fclose(source);
+    subDevices = calloc(count, sizeof(*subDevices));
+    assert(subDevices);
 
-    *retSrcBuf = srcBuf;
-    return size;
+    error = clCreateSubDevices(deviceId, properties, count, subDevices, NULL);
+    if (error != CL_SUCCESS) {
+        fprintf(stderr, "OpenCL error %d at %s:%d\n",
+                error, __FILE__, __LINE__);
+        free(subDevices);
+        return -1;
+    }
+
+    for (i = 0; i < count; ++i)
+        addDevice(platformId, subDevices[i], 1);
+
+    free(subDevices);
+    return 0;
 }
 
-static int initOpenCL(struct args *args)
+// builds the list of devices selected by --platform, --device and
+// --sub-devices
+static int findDevices(struct args *args)
 {
     cl_uint platformIdCount = 0;
     cl_platform_id *platformIds;
-    cl_platform_id platformId;
-    cl_uint deviceIdCount = 0;
+    cl_uint deviceIdCount;
     cl_device_id *deviceIds;
-    cl_device_id deviceId;
-    cl_context_properties contextProperties[] = {
-        CL_CONTEXT_PLATFORM,
-        0, 0, 0
-    };
-    cl_int error = 0;
-    char *srcBuf;
-    size_t srcSize;
-    int i;
+    cl_uint p, d;
+    int ret = 0;
 
     clGetPlatformIDs(0, NULL, &platformIdCount);
     if (platformIdCount == 0) {
@@ -414,176 +972,508 @@ static int initOpenCL(struct args *args)
         return -1;
     }
 
+    if (args->platform != OPENCL_ALL
+        && (cl_uint)args->platform >= platformIdCount) {
+        fprintf(stderr, "OpenCL platform %d not found\n", args->platform);
+        return -1;
+    }
+
     platformIds = calloc(platformIdCount, sizeof(*platformIds));
     assert(platformIds);
 
     clGetPlatformIDs(platformIdCount, platformIds, NULL);
-    platformId = platformIds[0];
+
+    for (p = 0; p < platformIdCount && !ret; ++p) {
+        if (args->platform != OPENCL_ALL && p != (cl_uint)args->platform)
+            continue;
+
+        deviceIdCount = 0;
+        clGetDeviceIDs(platformIds[p], CL_DEVICE_TYPE_ALL, 0, NULL,
+                       &deviceIdCount);
+        if (deviceIdCount == 0)
+            continue;
+
+        deviceIds = calloc(deviceIdCount, sizeof(*deviceIds));
+        assert(deviceIds);
+
+        clGetDeviceIDs(platformIds[p], CL_DEVICE_TYPE_ALL, deviceIdCount,
+                       deviceIds, NULL);
+
+        for (d = 0; d < deviceIdCount && !ret; ++d) {
+            if (args->device != OPENCL_ALL && d != (cl_uint)args->device)
+                continue;
+            ret = addSubDevices(args, platformIds[p], deviceIds[d]);
+        }
+
+        free(deviceIds);
+    }
+
     free(platformIds);
 
-    clGetDeviceIDs(platformId, CL_DEVICE_TYPE_ALL, 0, NULL, &deviceIdCount);
-    if (deviceIdCount == 0) {
+    if (!ret && !opencl_num_devices) {
         fprintf(stderr, "no OpenCL device found\n");
-        return -1;
+        ret = -1;
     }
 
-    deviceIds = calloc(deviceIdCount, sizeof(*deviceIds));
-    assert(deviceIds);
+    return ret;
+}
 
-    clGetDeviceIDs(platformId, CL_DEVICE_TYPE_ALL, deviceIdCount,
-                   deviceIds, NULL);
-    deviceId = deviceIds[0];
+// creates context, queues, program and pipeline slots of the device
+static int initDevice(struct args *args, struct opencl_device *device,
+                      const char *cacheDir)
+{
+    cl_context_properties contextProperties[] = {
+        CL_CONTEXT_PLATFORM,
+        (intptr_t)device->platformId, 0, 0
+    };
+    cl_int error = 0;
+    char buildOptions[128];
+    unsigned int i;
 
-    contextProperties[1] = (intptr_t)platformId;
+    device->context = clCreateContext(contextProperties, 1,
+                                      &device->deviceId, NULL, NULL, &error);
 
-    opencl_context = clCreateContext(contextProperties, deviceIdCount,
-                                     deviceIds, NULL, NULL, &error);
+    if (error != CL_SUCCESS) {
+        fprintf(stderr, "OpenCL error %d at %s:%d\n",
+                error, __FILE__, __LINE__);
+        return -1;
+    }
 
+    // separate queues let uploads and downloads overlap with kernels
+    device->writeQueue = clCreateCommandQueue(device->context,
+                                              device->deviceId, 0, &error);
+    if (error == CL_SUCCESS)
+        device->kernelQueue = clCreateCommandQueue(device->context,
+                                                   device->deviceId, 0,
+                                                   &error);
+    if (error == CL_SUCCESS)
+        device->readQueue = clCreateCommandQueue(device->context,
+                                                 device->deviceId, 0, &error);
     if (error != CL_SUCCESS) {
         fprintf(stderr, "OpenCL error %d at %s:%d\n",
                 error, __FILE__, __LINE__);
-        goto err_free_device_ids;
+        goto err_destroy_queues;
     }
 
-    for (i = 0; i < 2; ++i) {
-        opencl_queue[i] = clCreateCommandQueue(opencl_context, deviceId,
-                                               0, &error);
+    // specialize the kernel for this table, see PASSWORD_LENGTH in rainbow.cl
+    snprintf(buildOptions, sizeof(buildOptions),
+             "-DPASSWORD_LENGTH=%u -DCHAIN_LENGTH=%u",
+             args->passwordLength, args->chainLength);
+
+    device->program = programCacheBuild(device->context, device->deviceId,
+                                        rainbowKernelSource,
+                                        rainbowKernelSize, buildOptions,
+                                        cacheDir, &error);
+    if (error != CL_SUCCESS) {
+        fprintf(stderr, "OpenCL error %d at %s:%d\n",
+                error, __FILE__, __LINE__);
+        goto err_destroy_queues;
+    }
+
+    device->slots = calloc(args->pipelineDepth, sizeof(*device->slots));
+    assert(device->slots);
+
+    for (i = 0; i < args->pipelineDepth; ++i) {
+        error = createSlot(args, device, &device->slots[i]);
         if (error != CL_SUCCESS) {
             fprintf(stderr, "OpenCL error %d at %s:%d\n",
                     error, __FILE__, __LINE__);
-            goto err_destroy_queues;
+            goto err_free_slots;
         }
     }
 
-    srcSize = loadKernel(&srcBuf);
-    if (!srcSize) {
-        fprintf(stderr, "failed to load OpenCL kernel\n");
-        goto err_destroy_queues;
-    }
+    return 0;
 
-    opencl_program = clCreateProgramWithSource(opencl_context,
-                                               1, (const char **)&srcBuf,
-                                               &srcSize, &error);
-    if (error != CL_SUCCESS) {
-        fprintf(stderr, "OpenCL error %d at %s:%d\n",
-                error, __FILE__, __LINE__);
-        goto err_free_source;
-    }
+err_free_slots:
+    for (i = 0; i < args->pipelineDepth; ++i)
+        releaseSlot(&device->slots[i]);
+    free(device->slots);
+    device->slots = NULL;
 
-    error = clBuildProgram(opencl_program, deviceIdCount, deviceIds,
-                           NULL, NULL, NULL);
-    if (error != CL_SUCCESS) {
-        // Determine the size of the log
-        size_t log_size;
+    clReleaseProgram(device->program);
+    device->program = NULL;
 
-        clGetProgramBuildInfo(opencl_program, deviceId, CL_PROGRAM_BUILD_LOG,
-                              0, NULL, &log_size);
+err_destroy_queues:
+    if (device->readQueue)
+        clReleaseCommandQueue(device->readQueue);
+    if (device->kernelQueue)
+        clReleaseCommandQueue(device->kernelQueue);
+    if (device->writeQueue)
+        clReleaseCommandQueue(device->writeQueue);
 
-        // Allocate memory for the log
-        char *log = (char *) malloc(log_size);
+    clReleaseContext(device->context);
+    device->context = NULL;
 
-        // Get the log
-        clGetProgramBuildInfo(opencl_program, deviceId, CL_PROGRAM_BUILD_LOG,
-                              log_size, log, NULL);
+    return -1;
+}
 
-        // Print the log
-        fprintf(stderr, "OpenCL program compilation error:\n");
-        fprintf(stderr, "%s\n", log);
+static void releaseDevice(struct args *args, struct opencl_device *device)
+{
+    unsigned int i;
 
-        goto err_free_program;
-    }
+    if (device->context) {
+        for (i = 0; i < args->pipelineDepth; ++i)
+            releaseSlot(&device->slots[i]);
+        free(device->slots);
 
-    opencl_kernel = clCreateKernel(opencl_program, "rainbow", &error);
-    if (error != CL_SUCCESS) {
-        fprintf(stderr, "OpenCL error %d at %s:%d\n",
-                error, __FILE__, __LINE__);
-        goto err_free_program;
+        clReleaseProgram(device->program);
+
+        clReleaseCommandQueue(device->readQueue);
+        clReleaseCommandQueue(device->kernelQueue);
+        clReleaseCommandQueue(device->writeQueue);
+        clReleaseContext(device->context);
     }
 
+    if (device->subDevice)
+        clReleaseDevice(device->deviceId);
+}
+
+static void releaseOpenCL(struct args *args)
+{
+    unsigned int i;
+
+    for (i = 0; i < opencl_num_devices; ++i)
+        releaseDevice(args, &opencl_devices[i]);
+    free(opencl_devices);
+    opencl_devices = NULL;
+    opencl_num_devices = 0;
+}
+
+static int initOpenCL(struct args *args)
+{
+    const char *cacheDir = NULL;
+    unsigned int i;
+
+    if (findDevices(args))
+        goto err_release_devices;
+
+    if (!args->noCache)
+        cacheDir = args->cacheDir ? args->cacheDir : programCacheDefaultDir();
+
     /* Keep array elements aligned */
     passwordSize = (args->passwordLength + 15) & ~15;
     hashSize = (sizeof(hash_t) + 15) & ~15;
 
-    for (i = 0; i < 2; ++i) {
-        opencl_in_mem[i] = clCreateBuffer(opencl_context,
-                                          CL_MEM_READ_ONLY,
-                                          passwordSize * args->chainsInBlock,
-                                          NULL, &error);
-        if (error != CL_SUCCESS) {
-            fprintf(stderr, "OpenCL error %d at %s:%d\n",
-                    error, __FILE__, __LINE__);
-            goto err_free_buffers;
-        }
+    for (i = 0; i < opencl_num_devices; ++i) {
+        printf("Using OpenCL device %u: %s\n", i, opencl_devices[i].name);
+        if (initDevice(args, &opencl_devices[i], cacheDir))
+            goto err_release_devices;
+    }
 
-        opencl_out_mem[i] = clCreateBuffer(opencl_context,
-                                          CL_MEM_WRITE_ONLY,
-                                          hashSize * args->chainsInBlock,
-                                          NULL, &error);
-        if (error != CL_SUCCESS) {
-            fprintf(stderr, "OpenCL error %d at %s:%d\n",
-                    error, __FILE__, __LINE__);
-            goto err_free_buffers;
-        }
+    return 0;
+
+err_release_devices:
+    releaseOpenCL(args);
+
+    return -1;
+}
+
+// state shared by host threads of the OpenCL pipeline
+struct cl_pipeline {
+    struct args *args;
+    uint32_t numberOfBlocks;
+    // next block to prepare and to save, claimed atomically
+    uint32_t nextPrepared;
+    uint32_t nextSaved;
+    // blocks finished by every device, and by the CPU after them in hybrid
+    // mode, giving their relative throughput
+    uint32_t *finished;
+    unsigned int numWorkers;
+    // slots not retired by workerTooSlow
+    unsigned int liveSlots;
+    uint32_t cpuBlocks;
+    // hybrid mode only, generating CPU blocks and sorting device blocks
+    struct thread_pool *cpuPool;
+    struct thread_pool *sortPool;
+};
+
+struct cl_producer {
+    pthread_t thread;
+    struct cl_pipeline *pipeline;
+    sfmt_t rng;
+};
+
+struct cl_consumer {
+    pthread_t thread;
+    struct cl_pipeline *pipeline;
+    struct chain_sorter *sorter;
+};
+
+// index of the device generating blocks of the slot, the CPU follows
+// the devices
+static unsigned int slotWorker(struct cl_slot *slot)
+{
+    return slot->device ? slot->device - opencl_devices : opencl_num_devices;
+}
+
+// checks if the other workers would generate the block and all blocks after
+// it before the worker generates the block; all workers started together,
+// so the blocks they finished are proportional to their throughput
+static int workerTooSlow(struct cl_pipeline *pipeline, unsigned int worker,
+                         uint32_t block)
+{
+    uint32_t remaining = pipeline->numberOfBlocks - block;
+    uint32_t own, others = 0, fastest = 0;
+    unsigned int i;
+
+    for (i = 0; i < pipeline->numWorkers; ++i) {
+        uint32_t finished = __atomic_load_n(&pipeline->finished[i],
+                                            __ATOMIC_RELAXED);
+
+        if (i != worker)
+            others += finished;
+        if (finished > fastest)
+            fastest = finished;
     }
+    own = __atomic_load_n(&pipeline->finished[worker], __ATOMIC_RELAXED);
+
+    // the fastest worker takes every block, so that some worker always does
+    if (!own || own == fastest)
+        return 0;
 
-    tmp_buf = calloc(args->chainsInBlock, passwordSize > hashSize ?
-                                                    passwordSize : hashSize);
-    assert(tmp_buf);
+    return others > (uint64_t)remaining * own;
+}
 
-    free(srcBuf);
-    free(deviceIds);
+// takes a slot out of the pipeline unless it is the last one
+static int retireSlot(struct cl_pipeline *pipeline)
+{
+    if (__atomic_sub_fetch(&pipeline->liveSlots, 1, __ATOMIC_RELAXED))
+        return 1;
 
+    __atomic_add_fetch(&pipeline->liveSlots, 1, __ATOMIC_RELAXED);
     return 0;
+}
 
-err_free_buffers:
-    for (i = 0; i < 2; ++i) {
-        if (opencl_in_mem[i])
-            clReleaseMemObject(opencl_in_mem[i]);
-        if (opencl_out_mem[i])
-            clReleaseMemObject(opencl_out_mem[i]);
+// generates start points of blocks into free slots
+static void *producerThread(void *data)
+{
+    struct cl_producer *producer = data;
+    struct cl_pipeline *pipeline = producer->pipeline;
+    uint32_t block;
+
+    while ((block = __atomic_fetch_add(&pipeline->nextPrepared, 1,
+                                       __ATOMIC_RELAXED))
+                    < pipeline->numberOfBlocks) {
+        struct cl_slot *slot = workQueuePop(opencl_free_slots);
+
+        // near the end slots of slow workers are retired rather than
+        // given a block they would finish after the others
+        while (workerTooSlow(pipeline, slotWorker(slot), block)
+               && retireSlot(pipeline))
+            slot = workQueuePop(opencl_free_slots);
+
+        prepareBlockCl(pipeline->args, &producer->rng, slot, block);
+        workQueuePush(opencl_prepared_slots, slot);
     }
 
-    clReleaseKernel(opencl_kernel);
+    return NULL;
+}
 
-err_free_program:
-    clReleaseProgram(opencl_program);
+// sorts and stores downloaded blocks, then returns their slots
+static void *consumerThread(void *data)
+{
+    struct cl_consumer *consumer = data;
+    struct cl_pipeline *pipeline = consumer->pipeline;
 
-err_free_source:
-    free(srcBuf);
+    while (__atomic_fetch_add(&pipeline->nextSaved, 1, __ATOMIC_RELAXED)
+                    < pipeline->numberOfBlocks) {
+        struct cl_slot *slot = workQueuePop(opencl_completed_slots);
 
-err_destroy_queues:
-    for (i = 0; i < 2; ++i)
-        if (opencl_queue[i])
-            clReleaseCommandQueue(opencl_queue[i]);
+        __atomic_fetch_add(&pipeline->finished[slotWorker(slot)], 1,
+                           __ATOMIC_RELAXED);
 
-err_free_device_ids:
-    free(deviceIds);
+        finishBlockCl(slot);
+        saveBlockCl(pipeline->args, consumer->sorter, slot);
+        workQueuePush(opencl_free_slots, slot);
+    }
 
-    clReleaseContext(opencl_context);
+    return NULL;
+}
 
-    return -1;
+// generates blocks of hybrid mode on the CPU thread pool
+static void *cpuThread(void *data)
+{
+    struct cl_pipeline *pipeline = data;
+    struct cl_slot *slot;
+
+    while ((slot = workQueuePop(opencl_cpu_slots_queue))) {
+        processBlock(pipeline->args, pipeline->cpuPool, slot->chains);
+        workQueuePush(opencl_completed_slots, slot);
+    }
+
+    return NULL;
 }
 
-static void releaseOpenCL(void)
+// generates all blocks on the OpenCL devices with up to pipelineDepth
+// blocks in flight on each; producer threads prepare start points, this
+// thread only enqueues work for the devices and consumer threads save
+// finished blocks; in hybrid mode the CPU takes blocks from the same queue
+// of free slots as the devices
+static void generateOpenCL(struct args *args, uint32_t numberOfBlocks)
 {
-    int i;
+    struct cl_producer *producers;
+    struct cl_consumer *consumers;
+    struct cl_pipeline pipeline;
+    struct thread_pool *consumerPool = pool;
+    unsigned int sortThreads;
+    pthread_t cpu;
+    unsigned int numSlots;
+    uint32_t i, j;
+    int ret;
+
+    assert(initOpenCL(args) == 0);
+
+    numSlots = opencl_num_devices * args->pipelineDepth;
+    if (args->engine == ENGINE_HYBRID)
+        numSlots += CPU_SLOTS;
+    opencl_free_slots = workQueueCreate(numSlots);
+    opencl_prepared_slots = workQueueCreate(numSlots);
+    opencl_completed_slots = workQueueCreate(numSlots);
+    for (i = 0; i < opencl_num_devices; ++i) {
+        for (j = 0; j < args->pipelineDepth; ++j)
+            workQueuePush(opencl_free_slots, &opencl_devices[i].slots[j]);
+    }
+
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.args = args;
+    pipeline.numberOfBlocks = numberOfBlocks;
+    pipeline.numWorkers = opencl_num_devices;
+    if (args->engine == ENGINE_HYBRID)
+        ++pipeline.numWorkers;
+    pipeline.finished = calloc(pipeline.numWorkers,
+                               sizeof(*pipeline.finished));
+    assert(pipeline.finished);
+    pipeline.liveSlots = numSlots;
+
+    if (args->engine == ENGINE_HYBRID) {
+        sortThreads = args->threads / HYBRID_SORT_SHARE;
+        if (!sortThreads)
+            sortThreads = 1;
+        pipeline.sortPool = threadPoolCreate(sortThreads);
+        pipeline.cpuPool = threadPoolCreate(args->threads > sortThreads
+                                            ? args->threads - sortThreads
+                                            : 1);
+        consumerPool = pipeline.sortPool;
+
+        opencl_cpu_slots_queue = workQueueCreate(CPU_SLOTS + 1);
+        for (i = 0; i < CPU_SLOTS; ++i) {
+            struct cl_slot *slot = &opencl_cpu_slots[i];
+
+            slot->chains = calloc(args->chainsInBlock, sizeof(*slot->chains));
+            assert(slot->chains);
+            workQueuePush(opencl_free_slots, slot);
+        }
+
+        ret = pthread_create(&cpu, NULL, cpuThread, &pipeline);
+        assert(ret == 0);
+    }
+
+    producers = calloc(args->producers, sizeof(*producers));
+    assert(producers);
+    consumers = calloc(args->consumers, sizeof(*consumers));
+    assert(consumers);
+
+    for (i = 0; i < args->producers; ++i) {
+        producers[i].pipeline = &pipeline;
+        sfmt_init_gen_rand(&producers[i].rng, seed + i);
+        ret = pthread_create(&producers[i].thread, NULL,
+                             producerThread, &producers[i]);
+        assert(ret == 0);
+    }
+
+    for (i = 0; i < args->consumers; ++i) {
+        consumers[i].pipeline = &pipeline;
+        if (!bucketStore)
+            consumers[i].sorter = chainSorterCreate(consumerPool,
+                                                    args->chainsInBlock);
+        ret = pthread_create(&consumers[i].thread, NULL,
+                             consumerThread, &consumers[i]);
+        assert(ret == 0);
+    }
+
+    for (i = 0; i < numberOfBlocks; ++i) {
+        struct cl_slot *slot = workQueuePop(opencl_prepared_slots);
+
+        if (!slot->device) {
+            printf("Processing block %d of %d on CPU...\n", i + 1,
+                   numberOfBlocks);
+            ++pipeline.cpuBlocks;
+            workQueuePush(opencl_cpu_slots_queue, slot);
+            continue;
+        }
 
-    free(tmp_buf);
+        printf("Processing block %d of %d on device %u...\n", i + 1,
+               numberOfBlocks, (unsigned int)(slot->device - opencl_devices));
+        ++slot->device->blocks;
+        processBlockCl(args, slot);
+    }
 
-    for (i = 0; i < 2; ++i) {
-        clReleaseMemObject(opencl_in_mem[i]);
-        clReleaseMemObject(opencl_out_mem[i]);
+    if (args->engine == ENGINE_HYBRID) {
+        workQueuePush(opencl_cpu_slots_queue, NULL);
+        pthread_join(cpu, NULL);
     }
 
-    clReleaseKernel(opencl_kernel);
-    clReleaseProgram(opencl_program);
+    for (i = 0; i < args->producers; ++i)
+        pthread_join(producers[i].thread, NULL);
+
+    for (i = 0; i < args->consumers; ++i) {
+        pthread_join(consumers[i].thread, NULL);
+        if (consumers[i].sorter)
+            chainSorterDestroy(consumers[i].sorter);
+    }
 
-    for (i = 0; i < 2; ++i)
-        clReleaseCommandQueue(opencl_queue[i]);
-    clReleaseContext(opencl_context);
+    free(consumers);
+    free(producers);
+    free(pipeline.finished);
+
+    workQueueDestroy(opencl_completed_slots);
+    workQueueDestroy(opencl_prepared_slots);
+    workQueueDestroy(opencl_free_slots);
+
+    for (i = 0; i < opencl_num_devices; ++i)
+        printf("Device %u generated %u blocks\n", i,
+               opencl_devices[i].blocks);
+
+    if (args->engine == ENGINE_HYBRID) {
+        printf("CPU generated %u blocks\n", pipeline.cpuBlocks);
+        workQueueDestroy(opencl_cpu_slots_queue);
+        for (i = 0; i < CPU_SLOTS; ++i)
+            free(opencl_cpu_slots[i].chains);
+        threadPoolDestroy(pipeline.cpuPool);
+        threadPoolDestroy(pipeline.sortPool);
+    }
+
+    releaseOpenCL(args);
 }
 #endif
 
+// generates all blocks on the CPU thread pool
+static void generateCpu(struct args *args, uint32_t numberOfBlocks)
+{
+    struct chain_sorter *sorter = NULL;
+    struct rainbow_chain *chains;
+    uint32_t i;
+
+    // the OpenCL pipeline has chains of its own in every slot and a sorter
+    // in every consumer
+    chains = malloc(args->chainsInBlock * sizeof(*chains));
+    assert(chains);
+    if (!bucketStore)
+        sorter = chainSorterCreate(pool, args->chainsInBlock);
+
+    for (i = 0; i < numberOfBlocks; ++i) {
+        printf("Processing block %d of %d...\n", i + 1, numberOfBlocks);
+
+        prepareBlock(args, &sfmt, chains, i);
+        processBlock(args, pool, chains);
+        saveBlock(args, sorter, chains, i);
+    }
+
+    if (sorter)
+        chainSorterDestroy(sorter);
+    free(chains);
+}
+
 // entry point of the program
 int main(int argc, char **argv)
 {
@@ -591,20 +1481,25 @@ int main(int argc, char **argv)
     uint64_t numberOfPasswords;
     uint32_t numberOfBlocks;
     float workTimeSeconds;
+    struct run_store_config storeConfig;
     struct args args;
     uint32_t i;
     uint32_t min, max;
-    int current = 0;
-
-#if PIPELINING
-    struct rainbow_chain *chains[3];
 
+    memset(&args, 0, sizeof(args));
+#ifdef HAVE_OPENCL
+    args.engine = ENGINE_OPENCL;
 #else
-    struct rainbow_chain *chains[1];
-
+    args.engine = ENGINE_CPU;
 #endif
-
-    memset(&args, 0, sizeof(args));
+    args.threads = threadPoolDefaultSize();
+    args.mergeBuffer = DEFAULT_MERGE_BUFFER;
+    args.writeBuffer = DEFAULT_WRITE_BUFFER;
+    args.fanIn = runStoreDefaultFanIn();
+    args.pipelineDepth = DEFAULT_PIPELINE_DEPTH;
+    args.producers = DEFAULT_PRODUCERS;
+    args.consumers = DEFAULT_CONSUMERS;
+    args.mphFingerprintBits = TABLE_MPH_FINGERPRINT_BITS;
     parseArgs(&args, argc, argv);
 
     assert(args.chainsInBlock);
@@ -613,21 +1508,34 @@ int main(int argc, char **argv)
     assert(args.numberOfChains);
     assert(args.passwordLength <= MAX_PASSWD);
 
-#if OPENMP_MODE
-    printf("OpenMP mode selected.\n");
-
-#elif CILK_MODE
-    printf("Intel Cilk+ mode selected.\n");
-
-#else
-    printf("No parallel mode selected.\n");
+    if (args.simd) {
+        chainSimd = chainSimdFind(args.simd);
+        if (!chainSimd) {
+            fprintf(stderr, "SIMD implementation %s is not supported\n",
+                    args.simd);
+            exit(1);
+        }
+    } else {
+        chainSimd = chainSimdSelect();
+    }
+    chainGenerate = chainSimd->generate[args.passwordLength];
 
-#endif
+    if (args.engine == ENGINE_OPENCL)
+        printf("OpenCL engine selected.\n");
+    else if (args.engine == ENGINE_HYBRID)
+        printf("OpenCL and CPU engines selected, %u threads, "
+               "%s chain kernel.\n", args.threads, chainSimd->name);
+    else
+        printf("CPU engine selected, %u threads, %s chain kernel.\n",
+               args.threads, chainSimd->name);
 
     // init program
     startTime = measureTime(0);
 
-    sfmt_init_gen_rand(&sfmt, time(NULL));
+    seed = args.seedSet ? args.seed : (uint64_t)time(NULL);
+    sfmt_init_gen_rand(&sfmt, seed);
+    reductionStatsEnabled = args.showDist;
+    pool = threadPoolCreate(args.threads);
 
     numberOfPasswords = CHARSET_SIZE;
     for (i = 1; i < args.passwordLength; ++i) {
@@ -644,88 +1552,53 @@ int main(int argc, char **argv)
     printf("Number of rainbow chains:  %u\n", args.numberOfChains);
     printf("Rainbow chain block size:  %u\n", args.chainsInBlock);
     printf("Number of chain blocks:    %u\n", numberOfBlocks);
+    printf("Start point seed:          %llu (%s)\n",
+           (unsigned long long)seed,
+           args.startPoints == START_PHILOX ? "philox" : "random");
     printf("Estimated password coverage: %f%%\n", 100.0f *
                 args.numberOfChains * args.chainLength / numberOfPasswords);
 
-    chains[0] = malloc(args.chainsInBlock * sizeof(**chains));
-    assert(chains[0]);
-
-#if PIPELINING
-    chains[1] = malloc(args.chainsInBlock * sizeof(**chains));
-    assert(chains[1]);
-    chains[2] = malloc(args.chainsInBlock * sizeof(**chains));
-    assert(chains[2]);
-
-#endif
-
-#if PIPELINING
-    prepareBlock(&args, chains[0]);
-
-#endif
-
-#if OPENCL_MODE
-    assert(initOpenCL(&args) == 0);
-    prepareBlockCl(&args, chains[0], 0);
-
-#endif
-
-    current = 0;
-    for (i = 0; i < numberOfBlocks; ++i) {
-
-#if PIPELINING
-        uint32_t next = (current + 1) % 3;
-
-#endif
-
-        printf("Processing block %d of %d...\n", i + 1, numberOfBlocks);
-
-#if PIPELINING && CILK_MODE
-        if (i != numberOfBlocks - 1)
-            cilk_spawn prepareBlock(&args, chains[next]);
-        processBlock(&args, chains[current]);
-        cilk_sync;
-        cilk_spawn saveBlock(&args, chains[current], i);
-
-#elif OPENCL_MODE
-        processBlockCl(&args, chains[0], i % 2);
-        finishBlockCl((i - 1) % 2);
-        if (i != 0)
-            saveBlockCl(&args, chains[0], i - 1, (i - 1) % 2);
-        prepareBlockCl(&args, chains[0], (i + 1) % 2);
-
-#else
-        prepareBlock(&args, chains[current]);
-        processBlock(&args, chains[current]);
-        saveBlock(&args, chains[current], i);
-
-#endif
-
-#if PIPELINING
-        current = next;
-
-#endif
+    if (!args.noIndex) {
+        if (!args.indexBits)
+            args.indexBits = tableIndexDefaultBits(args.numberOfChains);
+        // buckets of compact tables have to be ranges of stored end-points
+        if (args.compact && args.endBits && args.indexBits > args.endBits)
+            args.indexBits = args.endBits;
+        indexBuilder = indexBuilderCreate(args.indexBits);
     }
 
-#if CILK_MODE
-    cilk_sync;
-
-#endif
-
-#if OPENCL_MODE
-    finishBlockCl((i - 1) % 2);
-    saveBlockCl(&args, chains[0], i - 1, (i - 1) % 2);
-
-#endif
-
-    free(chains[0]);
-
-#if PIPELINING
-    free(chains[1]);
-    free(chains[2]);
+    if (args.buckets) {
+        bucketStore = bucketStoreCreate(args.passwordLength, args.buckets);
+    } else {
+        storeConfig.passwordLength = args.passwordLength;
+        storeConfig.numberOfBlocks = numberOfBlocks;
+        storeConfig.chainsInBlock = args.chainsInBlock;
+        storeConfig.singleFile = args.runFile;
+        storeConfig.memoryBudget = (uint64_t)args.memoryBudget << 20;
+        storeConfig.fanIn = args.fanIn;
+        storeConfig.mergeFactor = args.mergeFactor;
+        storeConfig.readBuffer = (size_t)args.mergeBuffer * 1024;
+        storeConfig.writeBuffer = (size_t)args.writeBuffer * 1024;
+        storeConfig.pool = pool;
+        runStore = runStoreCreate(&storeConfig);
+    }
 
+#ifdef HAVE_OPENCL
+    if (args.engine != ENGINE_CPU)
+        generateOpenCL(&args, numberOfBlocks);
+    else
 #endif
-
-    sortTables(&args, numberOfBlocks);
+        generateCpu(&args, numberOfBlocks);
+
+    sortTables(&args);
+    if (indexBuilder)
+        indexBuilderDestroy(indexBuilder);
+    if (bucketStore) {
+        bucketStoreDestroy(bucketStore);
+    } else {
+        runStoreDestroy(runStore);
+    }
+    threadPoolDestroy(pool);
 
     totalTime = measureTime(startTime);
     workTimeSeconds = (float)totalTime / USEC_PER_SEC;
@@ -0,0 +1,418 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chain_sort.h"
+#include "merge.h"
+
+// key ranges per thread of a parallel merge, for load balancing
+#define RANGES_PER_THREAD       4
+
+// current position in one run of the merge
+struct run_reader {
+    const struct chain_run *run;
+    struct rainbow_chain *buffer;
+    size_t capacity;
+    size_t pos;
+    size_t fill;
+    // chains of the run not read into the buffer yet
+    uint64_t unread;
+    off_t offset;
+    // key of buffer[pos], valid unless done
+    uint64_t key;
+    int done;
+};
+
+static void readFully(int fd, void *buf, size_t size, off_t offset)
+{
+    uint8_t *p = buf;
+
+    while (size) {
+        ssize_t ret = pread(fd, p, size, offset);
+
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            perror("Error reading run");
+            exit(1);
+        }
+        p += ret;
+        size -= ret;
+        offset += ret;
+    }
+}
+
+void writeFully(int fd, const void *buf, size_t size, off_t offset)
+{
+    const uint8_t *p = buf;
+
+    while (size) {
+        ssize_t ret = pwrite(fd, p, size, offset);
+
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            perror("Error writing table");
+            exit(1);
+        }
+        p += ret;
+        size -= ret;
+        offset += ret;
+    }
+}
+
+void chainsRead(int fd, struct rainbow_chain *chains, size_t count,
+                off_t offset)
+{
+    readFully(fd, chains, count * sizeof(*chains), offset);
+}
+
+void chainsWrite(int fd, const struct rainbow_chain *chains, size_t count,
+                 off_t offset)
+{
+    writeFully(fd, chains, count * sizeof(*chains), offset);
+}
+
+void chainWriterInit(struct chain_writer *writer, int fd, off_t offset,
+                     size_t bufferSize)
+{
+    writer->fd = fd;
+    writer->offset = offset;
+    writer->used = 0;
+    writer->capacity = bufferSize / sizeof(struct rainbow_chain);
+    if (!writer->capacity)
+        writer->capacity = 1;
+
+    writer->buffer = malloc(writer->capacity * sizeof(*writer->buffer));
+    assert(writer->buffer);
+}
+
+void chainWriterFlush(struct chain_writer *writer)
+{
+    size_t size = writer->used * sizeof(*writer->buffer);
+
+    writeFully(writer->fd, writer->buffer, size, writer->offset);
+    writer->offset += size;
+    writer->used = 0;
+}
+
+void chainWriterClose(struct chain_writer *writer)
+{
+    chainWriterFlush(writer);
+    free(writer->buffer);
+    writer->buffer = NULL;
+}
+
+static inline struct rainbow_chain *chainWriterNext(
+                                        struct chain_writer *writer)
+{
+    if (writer->used == writer->capacity)
+        chainWriterFlush(writer);
+
+    return &writer->buffer[writer->used++];
+}
+
+static void readerRefill(struct run_reader *reader)
+{
+    size_t count = reader->capacity;
+
+    if (count > reader->unread)
+        count = reader->unread;
+
+    if (!count) {
+        reader->done = 1;
+        return;
+    }
+
+    readFully(reader->run->fd, reader->buffer,
+              count * sizeof(*reader->buffer), reader->offset);
+    reader->offset += count * sizeof(*reader->buffer);
+    reader->unread -= count;
+    reader->pos = 0;
+    reader->fill = count;
+    reader->key = hashKey(reader->buffer[0].hash);
+}
+
+static inline void readerAdvance(struct run_reader *reader)
+{
+    if (++reader->pos == reader->fill) {
+        readerRefill(reader);
+        return;
+    }
+
+    reader->key = hashKey(reader->buffer[reader->pos].hash);
+}
+
+// whether head of run a goes before head of run b; finished runs are last
+static inline int readerLess(const struct run_reader *readers,
+                             unsigned int a, unsigned int b)
+{
+    const struct run_reader *ra = &readers[a];
+    const struct run_reader *rb = &readers[b];
+
+    if (ra->done || rb->done)
+        return !ra->done && rb->done;
+    if (ra->key != rb->key)
+        return ra->key < rb->key;
+
+    return memcmp(ra->buffer[ra->pos].hash, rb->buffer[rb->pos].hash,
+                  sizeof(hash_t)) < 0;
+}
+
+// tree[0] is the overall winner, tree[1..k-1] hold losers of the inner
+// matches; leaf of run i is node k + i
+static void loserTreeBuild(unsigned int *tree, const struct run_reader *readers,
+                           unsigned int k)
+{
+    unsigned int *winners;
+    unsigned int i;
+
+    if (k == 1) {
+        tree[0] = 0;
+        return;
+    }
+
+    winners = malloc(2 * k * sizeof(*winners));
+    assert(winners);
+
+    for (i = 0; i < k; ++i)
+        winners[k + i] = i;
+
+    for (i = k - 1; i > 0; --i) {
+        unsigned int left = winners[2 * i];
+        unsigned int right = winners[2 * i + 1];
+
+        if (readerLess(readers, right, left)) {
+            winners[i] = right;
+            tree[i] = left;
+        } else {
+            winners[i] = left;
+            tree[i] = right;
+        }
+    }
+
+    tree[0] = winners[1];
+    free(winners);
+}
+
+// replays matches on the path from the leaf of the last winner to the root
+static inline void loserTreeReplay(unsigned int *tree,
+                                   const struct run_reader *readers,
+                                   unsigned int k)
+{
+    unsigned int winner = tree[0];
+    unsigned int node;
+
+    for (node = (k + winner) / 2; node > 0; node /= 2) {
+        if (readerLess(readers, tree[node], winner)) {
+            unsigned int loser = winner;
+
+            winner = tree[node];
+            tree[node] = loser;
+        }
+    }
+
+    tree[0] = winner;
+}
+
+void mergeRuns(const struct chain_run *runs, unsigned int numRuns,
+               struct chain_writer *out, size_t readBuffer)
+{
+    struct run_reader *readers;
+    unsigned int *tree;
+    size_t capacity;
+    uint64_t total = 0;
+    unsigned int i;
+
+    if (!numRuns)
+        return;
+
+    capacity = readBuffer / sizeof(struct rainbow_chain);
+    if (!capacity)
+        capacity = 1;
+
+    readers = calloc(numRuns, sizeof(*readers));
+    assert(readers);
+
+    tree = malloc(numRuns * sizeof(*tree));
+    assert(tree);
+
+    for (i = 0; i < numRuns; ++i) {
+        struct run_reader *reader = &readers[i];
+
+        reader->run = &runs[i];
+        total += runs[i].count;
+
+        // in-memory runs are consumed in place, as one full buffer
+        if (runs[i].chains) {
+            reader->buffer = (struct rainbow_chain *)runs[i].chains;
+            reader->fill = runs[i].count;
+            reader->done = !runs[i].count;
+            if (!reader->done)
+                reader->key = hashKey(reader->buffer[0].hash);
+            continue;
+        }
+
+        reader->capacity = capacity;
+        if (reader->capacity > runs[i].count)
+            reader->capacity = runs[i].count;
+        if (reader->capacity) {
+            reader->buffer = malloc(reader->capacity * sizeof(*reader->buffer));
+            assert(reader->buffer);
+        }
+        reader->unread = runs[i].count;
+        reader->offset = runs[i].offset;
+        readerRefill(reader);
+    }
+
+    loserTreeBuild(tree, readers, numRuns);
+
+    while (total--) {
+        struct run_reader *reader = &readers[tree[0]];
+
+        *chainWriterNext(out) = reader->buffer[reader->pos];
+        readerAdvance(reader);
+        loserTreeReplay(tree, readers, numRuns);
+    }
+
+    for (i = 0; i < numRuns; ++i) {
+        if (!runs[i].chains)
+            free(readers[i].buffer);
+    }
+    free(tree);
+    free(readers);
+}
+
+// index of the first chain of the run with key not lower than given key
+static uint64_t runLowerBound(const struct chain_run *run, uint64_t key)
+{
+    uint64_t low = 0, high = run->count;
+
+    while (low < high) {
+        uint64_t mid = low + (high - low) / 2;
+        struct rainbow_chain chain;
+
+        if (run->chains)
+            chain = run->chains[mid];
+        else
+            readFully(run->fd, &chain, sizeof(chain),
+                      run->offset + mid * sizeof(chain));
+
+        if (hashKey(chain.hash) < key)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+struct parallel_merge {
+    const struct chain_run *runs;
+    unsigned int numRuns;
+    // bounds[r * numRuns + i] is the first chain of run i in range r
+    uint64_t *bounds;
+    // first output chain of every range
+    uint64_t *outStart;
+    int fd;
+    off_t offset;
+    size_t readBuffer;
+    size_t writeBuffer;
+};
+
+static void mergeRanges(void *data, size_t begin, size_t end,
+                        unsigned int worker)
+{
+    struct parallel_merge *merge = data;
+    unsigned int numRuns = merge->numRuns;
+    struct chain_run *ranges;
+    size_t r;
+    unsigned int i;
+
+    (void)worker;
+
+    ranges = malloc(numRuns * sizeof(*ranges));
+    assert(ranges);
+
+    for (r = begin; r < end; ++r) {
+        const uint64_t *first = &merge->bounds[r * numRuns];
+        const uint64_t *last = &merge->bounds[(r + 1) * numRuns];
+        struct chain_writer writer;
+
+        for (i = 0; i < numRuns; ++i) {
+            const struct chain_run *run = &merge->runs[i];
+
+            ranges[i].chains = run->chains ? run->chains + first[i] : NULL;
+            ranges[i].fd = run->fd;
+            ranges[i].offset = run->offset + first[i] * sizeof(*run->chains);
+            ranges[i].count = last[i] - first[i];
+        }
+
+        chainWriterInit(&writer, merge->fd, merge->offset
+                            + merge->outStart[r] * sizeof(struct rainbow_chain),
+                        merge->writeBuffer);
+        mergeRuns(ranges, numRuns, &writer, merge->readBuffer);
+        chainWriterClose(&writer);
+    }
+
+    free(ranges);
+}
+
+void mergeRunsParallel(struct thread_pool *pool, const struct chain_run *runs,
+                       unsigned int numRuns, int fd, off_t offset,
+                       size_t readBuffer, size_t writeBuffer)
+{
+    unsigned int numThreads = pool ? threadPoolSize(pool) : 1;
+    unsigned int numRanges = numThreads * RANGES_PER_THREAD;
+    struct parallel_merge merge;
+    struct chain_writer writer;
+    uint64_t total = 0;
+    unsigned int r, i;
+
+    if (numThreads == 1 || !numRuns) {
+        chainWriterInit(&writer, fd, offset, writeBuffer);
+        mergeRuns(runs, numRuns, &writer, readBuffer);
+        chainWriterClose(&writer);
+        return;
+    }
+
+    merge.runs = runs;
+    merge.numRuns = numRuns;
+    merge.fd = fd;
+    merge.offset = offset;
+    merge.readBuffer = readBuffer / numThreads;
+    merge.writeBuffer = writeBuffer / numThreads;
+
+    merge.bounds = malloc((size_t)(numRanges + 1) * numRuns
+                          * sizeof(*merge.bounds));
+    assert(merge.bounds);
+    merge.outStart = malloc(numRanges * sizeof(*merge.outStart));
+    assert(merge.outStart);
+
+    // range r starts at key r * 2^64 / numRanges, roughly
+    for (i = 0; i < numRuns; ++i) {
+        merge.bounds[i] = 0;
+        merge.bounds[numRanges * numRuns + i] = runs[i].count;
+    }
+    for (r = 1; r < numRanges; ++r) {
+        uint64_t key = r * (UINT64_MAX / numRanges);
+
+        for (i = 0; i < numRuns; ++i)
+            merge.bounds[r * numRuns + i] = runLowerBound(&runs[i], key);
+    }
+
+    for (r = 0; r < numRanges; ++r) {
+        merge.outStart[r] = total;
+        for (i = 0; i < numRuns; ++i)
+            total += merge.bounds[(r + 1) * numRuns + i]
+                        - merge.bounds[r * numRuns + i];
+    }
+
+    threadPoolFor(pool, numRanges, 1, mergeRanges, &merge);
+
+    free(merge.outStart);
+    free(merge.bounds);
+}
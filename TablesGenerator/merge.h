@@ -0,0 +1,59 @@
+#ifndef _MERGE_H
+#define _MERGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "rainbow_chain.h"
+#include "thread_pool.h"
+
+// sorted sequence of chains stored in memory or in a file
+struct chain_run {
+    // chains of in-memory runs, NULL if the run is read from fd
+    const struct rainbow_chain *chains;
+    int fd;
+    // byte offset of the first chain
+    off_t offset;
+    uint64_t count;
+};
+
+// reads or writes count chains at byte offset, exiting on I/O errors
+void chainsRead(int fd, struct rainbow_chain *chains, size_t count,
+                off_t offset);
+void chainsWrite(int fd, const struct rainbow_chain *chains, size_t count,
+                 off_t offset);
+// writes size bytes at offset, exiting on I/O errors
+void writeFully(int fd, const void *buf, size_t size, off_t offset);
+
+// buffered writer of chains to a file region
+struct chain_writer {
+    int fd;
+    off_t offset;
+    struct rainbow_chain *buffer;
+    size_t used;
+    size_t capacity;
+};
+
+// bufferSize is in bytes, rounded down to whole chains
+void chainWriterInit(struct chain_writer *writer, int fd, off_t offset,
+                     size_t bufferSize);
+void chainWriterFlush(struct chain_writer *writer);
+// flushes remaining chains and frees the buffer
+void chainWriterClose(struct chain_writer *writer);
+
+// merges runs into writer with a loser tree, reading every run through a
+// read-ahead buffer of readBuffer bytes
+void mergeRuns(const struct chain_run *runs, unsigned int numRuns,
+               struct chain_writer *out, size_t readBuffer);
+
+// merges runs into fd at offset in parallel: the key space is split into
+// ranges of equal width, which hold similar numbers of uniformly distributed
+// MD5 end-points, and every range is merged by one pool task writing at its
+// own precomputed offset; buffer sizes are shared by all threads, NULL pool
+// merges in the calling thread
+void mergeRunsParallel(struct thread_pool *pool, const struct chain_run *runs,
+                       unsigned int numRuns, int fd, off_t offset,
+                       size_t readBuffer, size_t writeBuffer);
+
+#endif
@@ -0,0 +1,251 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "merge.h"
+#include "mph_writer.h"
+
+// keys or rows handled by one pool task
+#define MPH_GRAIN               65536
+
+struct mph_build {
+    const struct table_header *table;
+    const uint8_t *rows;
+    struct table_mph_header header;
+    struct table_mph mph;
+    // keys left for the current level
+    uint64_t *keys;
+    uint64_t numKeys;
+    uint32_t level;
+    uint64_t levelSize;
+    // bits of the current level hit by a key and by more than one
+    uint64_t *seen;
+    uint64_t *collided;
+    uint64_t *words;
+    uint64_t *entries;
+};
+
+static inline uint64_t rowKey(const struct mph_build *build, uint64_t index)
+{
+    const uint8_t *row = build->rows + index * build->table->rowBytes;
+
+    if (build->table->format == TABLE_FORMAT_COMPACT)
+        return compactRowEnd(row, build->table);
+
+    return hashKey(((const struct rainbow_chain *)row)->hash);
+}
+
+static void markKeys(void *data, size_t begin, size_t end,
+                     unsigned int worker)
+{
+    struct mph_build *build = data;
+    size_t i;
+
+    for (i = begin; i < end; ++i) {
+        uint64_t bit = tableMphHash(build->keys[i], build->level,
+                                    build->levelSize);
+        uint64_t mask = 1ull << (bit % 64);
+
+        if (__atomic_fetch_or(&build->seen[bit / 64], mask, __ATOMIC_RELAXED)
+            & mask)
+            __atomic_fetch_or(&build->collided[bit / 64], mask,
+                              __ATOMIC_RELAXED);
+    }
+}
+
+static void fillEntries(void *data, size_t begin, size_t end,
+                        unsigned int worker)
+{
+    struct mph_build *build = data;
+    uint32_t fingerprintBits = build->header.fingerprintBits;
+    uint32_t bits = build->header.rowBits + fingerprintBits;
+    size_t i;
+
+    for (i = begin; i < end; ++i) {
+        uint64_t key = rowKey(build, i);
+        uint64_t slot, entry, bit;
+        int ret;
+
+        // entries point to the first row of every key
+        if (i && rowKey(build, i - 1) == key)
+            continue;
+
+        ret = tableMphSlot(&build->mph, key, &slot);
+        assert(ret && slot < build->header.numKeys);
+        entry = ((uint64_t)i << fingerprintBits)
+                | tableMphFingerprint(key, fingerprintBits);
+
+        // entries of other tasks may share words
+        bit = slot * bits;
+        __atomic_fetch_or(&build->entries[bit / 64], entry << (bit % 64),
+                          __ATOMIC_RELAXED);
+        if (bit % 64 + bits > 64)
+            __atomic_fetch_or(&build->entries[bit / 64 + 1],
+                              entry >> (64 - bit % 64), __ATOMIC_RELAXED);
+    }
+}
+
+// distinct keys of the sorted table
+static void collectKeys(struct mph_build *build)
+{
+    uint64_t n = build->table->numberOfChains;
+    uint64_t i;
+
+    build->keys = malloc(n * sizeof(*build->keys));
+    assert(build->keys);
+
+    build->numKeys = 0;
+    for (i = 0; i < n; ++i) {
+        uint64_t key = rowKey(build, i);
+
+        if (build->numKeys && build->keys[build->numKeys - 1] == key)
+            continue;
+        build->keys[build->numKeys++] = key;
+    }
+}
+
+// places keys on levels until none is left, returns 0 on success
+static int buildLevels(struct mph_build *build, struct thread_pool *pool)
+{
+    struct table_mph_header *header = &build->header;
+    uint64_t numWords = 0;
+    uint64_t left, i, w;
+
+    for (build->level = 0; build->numKeys; ++build->level) {
+        if (build->level == TABLE_MPH_MAX_LEVELS)
+            return -1;
+
+        build->levelSize = tableMphLevelSize(build->numKeys);
+        build->seen = calloc(build->levelSize / 64, sizeof(uint64_t));
+        assert(build->seen);
+        build->collided = calloc(build->levelSize / 64, sizeof(uint64_t));
+        assert(build->collided);
+
+        threadPoolFor(pool, build->numKeys, MPH_GRAIN, markKeys, build);
+
+        build->words = realloc(build->words, (numWords + build->levelSize / 64)
+                                             * sizeof(uint64_t));
+        assert(build->words);
+        for (w = 0; w < build->levelSize / 64; ++w)
+            build->words[numWords + w] = build->seen[w] & ~build->collided[w];
+
+        // keys which collided are left for the next level
+        left = 0;
+        for (i = 0; i < build->numKeys; ++i) {
+            uint64_t bit = tableMphHash(build->keys[i], build->level,
+                                        build->levelSize);
+
+            if (build->collided[bit / 64] & (1ull << (bit % 64)))
+                build->keys[left++] = build->keys[i];
+        }
+        build->numKeys = left;
+
+        free(build->seen);
+        free(build->collided);
+        numWords += build->levelSize / 64;
+        header->levelOffset[build->level + 1] = numWords * 64;
+    }
+
+    header->numLevels = build->level;
+    header->numWords = numWords;
+    return 0;
+}
+
+void tableMphWrite(const char *tablePath, const struct table_header *table,
+                   const char *path, uint32_t fingerprintBits,
+                   struct thread_pool *pool)
+{
+    struct table_mph_header *header;
+    struct mph_build build;
+    uint64_t *ranks;
+    uint64_t numRanks, numEntryWords, rank, w;
+    struct stat st;
+    const uint8_t *map;
+    off_t offset;
+    int fd;
+
+    memset(&build, 0, sizeof(build));
+    build.table = table;
+    header = &build.header;
+
+    fd = open(tablePath, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st)) {
+        perror("Error opening table");
+        exit(1);
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("Error mapping table");
+        exit(1);
+    }
+    close(fd);
+    madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+    build.rows = map + table->headerSize;
+
+    memcpy(header->magic, TABLE_MPH_MAGIC, sizeof(header->magic));
+    header->version = TABLE_MPH_VERSION;
+    header->numberOfChains = table->numberOfChains;
+    header->seed = table->seed;
+    header->format = table->format;
+    header->chainLength = table->chainLength;
+    header->rowBits = tableBitsFor(table->numberOfChains);
+    header->fingerprintBits = fingerprintBits;
+    if (header->rowBits + fingerprintBits > 64)
+        header->fingerprintBits = 64 - header->rowBits;
+
+    collectKeys(&build);
+    header->numKeys = build.numKeys;
+
+    if (buildLevels(&build, pool)) {
+        fprintf(stderr, "Failed to build perfect hash of %s\n", tablePath);
+        exit(1);
+    }
+    free(build.keys);
+
+    numRanks = header->numWords / TABLE_MPH_RANK_WORDS + 1;
+    ranks = malloc(numRanks * sizeof(*ranks));
+    assert(ranks);
+    rank = 0;
+    for (w = 0; w < numRanks * TABLE_MPH_RANK_WORDS; ++w) {
+        if (w % TABLE_MPH_RANK_WORDS == 0)
+            ranks[w / TABLE_MPH_RANK_WORDS] = rank;
+        if (w < header->numWords)
+            rank += __builtin_popcountll(build.words[w]);
+    }
+    assert(rank == header->numKeys);
+
+    build.mph.header = header;
+    build.mph.words = build.words;
+    build.mph.ranks = ranks;
+    numEntryWords = tableMphEntryWords(header);
+    build.entries = calloc(numEntryWords, sizeof(*build.entries));
+    assert(build.entries);
+    threadPoolFor(pool, table->numberOfChains, MPH_GRAIN, fillEntries,
+                  &build);
+    munmap((void *)map, st.st_size);
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Error opening perfect hash");
+        exit(1);
+    }
+
+    offset = 0;
+    writeFully(fd, header, sizeof(*header), offset);
+    offset += sizeof(*header);
+    writeFully(fd, build.words, header->numWords * sizeof(uint64_t), offset);
+    offset += header->numWords * sizeof(uint64_t);
+    writeFully(fd, ranks, numRanks * sizeof(uint64_t), offset);
+    offset += numRanks * sizeof(uint64_t);
+    writeFully(fd, build.entries, numEntryWords * sizeof(uint64_t), offset);
+    close(fd);
+
+    free(build.entries);
+    free(ranks);
+    free(build.words);
+}
@@ -0,0 +1,15 @@
+#ifndef _MPH_WRITER_H
+#define _MPH_WRITER_H
+
+#include "table_header.h"
+#include "table_mph.h"
+#include "thread_pool.h"
+
+// builds the perfect hash of end-points of the sorted table at tablePath,
+// described by header, and writes it to path with entries of given
+// fingerprint bits; levels and entries are filled by pool tasks
+void tableMphWrite(const char *tablePath, const struct table_header *header,
+                   const char *path, uint32_t fingerprintBits,
+                   struct thread_pool *pool);
+
+#endif
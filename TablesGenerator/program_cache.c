@@ -0,0 +1,249 @@
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "md5.h"
+#include "program_cache.h"
+#include "utils.h"
+
+// device properties identifying the compiler which produced a binary
+static const cl_device_info keyInfo[] = {
+    CL_DEVICE_NAME,
+    CL_DEVICE_VENDOR,
+    CL_DEVICE_VERSION,
+    CL_DRIVER_VERSION,
+};
+
+// cache file name is the MD5 hash of device properties, source hash
+// and build options
+static void cacheFileName(char *out, const char *cacheDir,
+                          cl_device_id deviceId, const char *source,
+                          size_t size, const char *options)
+{
+    char key[4096];
+    char info[256];
+    hash_t hash;
+    size_t len = 0;
+    unsigned int i;
+
+    for (i = 0; i < sizeof(keyInfo) / sizeof(keyInfo[0]); ++i) {
+        info[0] = '\0';
+        clGetDeviceInfo(deviceId, keyInfo[i], sizeof(info), info, NULL);
+        info[sizeof(info) - 1] = '\0';
+        len += snprintf(key + len, sizeof(key) - len, "%s\n", info);
+    }
+
+    md5(source, size, hash);
+    printHash(info, hash);
+    len += snprintf(key + len, sizeof(key) - len, "%s\n%s", info, options);
+    assert(len < sizeof(key));
+
+    md5(key, len, hash);
+    printHash(info, hash);
+    sprintf(out, "%s/%s.bin", cacheDir, info);
+}
+
+// creates directory with its parents
+static int makeDirs(const char *path)
+{
+    char tmp[PATH_MAX];
+    char *p;
+
+    if (snprintf(tmp, sizeof(tmp), "%s", path) >= sizeof(tmp))
+        return -1;
+
+    for (p = tmp + 1; *p; ++p) {
+        if (*p != '/')
+            continue;
+        *p = '\0';
+        if (mkdir(tmp, 0755) && errno != EEXIST)
+            return -1;
+        *p = '/';
+    }
+
+    if (mkdir(tmp, 0755) && errno != EEXIST)
+        return -1;
+
+    return 0;
+}
+
+static unsigned char *readFile(const char *path, size_t *size)
+{
+    unsigned char *buf;
+    struct stat st;
+    FILE *file;
+
+    file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+
+    if (fstat(fileno(file), &st) || !st.st_size) {
+        fclose(file);
+        return NULL;
+    }
+
+    buf = malloc(st.st_size);
+    assert(buf);
+
+    if (fread(buf, 1, st.st_size, file) != (size_t)st.st_size) {
+        free(buf);
+        fclose(file);
+        return NULL;
+    }
+
+    fclose(file);
+    *size = st.st_size;
+    return buf;
+}
+
+// saves the binary under a temporary name first, so that concurrent runs
+// never load a partially written file
+static void saveBinary(cl_program program, const char *cacheDir,
+                       const char *path)
+{
+    char tmpPath[PATH_MAX + 32];
+    unsigned char *binary;
+    size_t size = 0;
+    FILE *file;
+    int ok;
+
+    clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size),
+                     &size, NULL);
+    if (!size)
+        return;
+
+    binary = malloc(size);
+    assert(binary);
+
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binary),
+                         &binary, NULL) != CL_SUCCESS)
+        goto out;
+
+    if (makeDirs(cacheDir)) {
+        fprintf(stderr, "failed to create program cache %s\n", cacheDir);
+        goto out;
+    }
+
+    snprintf(tmpPath, sizeof(tmpPath), "%s.%d.tmp", path, (int)getpid());
+    file = fopen(tmpPath, "wb");
+    if (!file) {
+        fprintf(stderr, "failed to write program cache %s\n", tmpPath);
+        goto out;
+    }
+
+    ok = fwrite(binary, 1, size, file) == size;
+    ok = !fclose(file) && ok;
+    if (!ok || rename(tmpPath, path)) {
+        fprintf(stderr, "failed to write program cache %s\n", path);
+        unlink(tmpPath);
+    }
+
+out:
+    free(binary);
+}
+
+// loads the program from a cached binary, NULL if it is missing or rejected
+static cl_program loadBinary(cl_context context, cl_device_id deviceId,
+                             const char *options, const char *path)
+{
+    cl_program program;
+    unsigned char *binary;
+    cl_int binaryStatus;
+    cl_int error;
+    size_t size;
+
+    binary = readFile(path, &size);
+    if (!binary)
+        return NULL;
+
+    program = clCreateProgramWithBinary(context, 1, &deviceId, &size,
+                                        (const unsigned char **)&binary,
+                                        &binaryStatus, &error);
+    free(binary);
+
+    if (error != CL_SUCCESS)
+        return NULL;
+
+    if (binaryStatus == CL_SUCCESS)
+        error = clBuildProgram(program, 1, &deviceId, options, NULL, NULL);
+    if (binaryStatus != CL_SUCCESS || error != CL_SUCCESS) {
+        clReleaseProgram(program);
+        return NULL;
+    }
+
+    return program;
+}
+
+cl_program programCacheBuild(cl_context context, cl_device_id deviceId,
+                             const char *source, size_t size,
+                             const char *options, const char *cacheDir,
+                             cl_int *error)
+{
+    char path[PATH_MAX];
+    cl_program program;
+
+    if (cacheDir) {
+        cacheFileName(path, cacheDir, deviceId, source, size, options);
+        program = loadBinary(context, deviceId, options, path);
+        if (program) {
+            *error = CL_SUCCESS;
+            return program;
+        }
+    }
+
+    program = clCreateProgramWithSource(context, 1, &source, &size, error);
+    if (*error != CL_SUCCESS)
+        return NULL;
+
+    *error = clBuildProgram(program, 1, &deviceId, options, NULL, NULL);
+    if (*error != CL_SUCCESS) {
+        // Determine the size of the log
+        size_t log_size;
+
+        clGetProgramBuildInfo(program, deviceId, CL_PROGRAM_BUILD_LOG,
+                              0, NULL, &log_size);
+
+        // Allocate memory for the log
+        char *log = (char *) malloc(log_size);
+
+        // Get the log
+        clGetProgramBuildInfo(program, deviceId, CL_PROGRAM_BUILD_LOG,
+                              log_size, log, NULL);
+
+        // Print the log
+        fprintf(stderr, "OpenCL program compilation error:\n");
+        fprintf(stderr, "%s\n", log);
+
+        free(log);
+        clReleaseProgram(program);
+        return NULL;
+    }
+
+    if (cacheDir)
+        saveBinary(program, cacheDir, path);
+
+    return program;
+}
+
+const char *programCacheDefaultDir(void)
+{
+    static char dir[PATH_MAX];
+    const char *base = getenv("XDG_CACHE_HOME");
+
+    if (base && *base) {
+        snprintf(dir, sizeof(dir), "%s/rainbowcl", base);
+        return dir;
+    }
+
+    base = getenv("HOME");
+    if (!base || !*base)
+        return NULL;
+
+    snprintf(dir, sizeof(dir), "%s/.cache/rainbowcl", base);
+    return dir;
+}
@@ -0,0 +1,20 @@
+#ifndef _PROGRAM_CACHE_H
+#define _PROGRAM_CACHE_H
+
+#include <stddef.h>
+
+#include <CL/cl.h>
+
+// builds program from source for the device; with cacheDir set, the program
+// binary is saved there under a key of the device, driver version, source
+// and options, and loaded with clCreateProgramWithBinary on later builds;
+// build log is printed on failure
+cl_program programCacheBuild(cl_context context, cl_device_id deviceId,
+                             const char *source, size_t size,
+                             const char *options, const char *cacheDir,
+                             cl_int *error);
+
+// $XDG_CACHE_HOME/rainbowcl or ~/.cache/rainbowcl, NULL if neither is set
+const char *programCacheDefaultDir(void);
+
+#endif
@@ -0,0 +1,646 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "merge.h"
+#include "run_store.h"
+
+// file descriptors left for the process besides merged runs
+#define RESERVED_FDS            32
+#define MAX_DEFAULT_FAN_IN      512
+
+#define MAX_LEVELS              64
+
+struct stored_run {
+    // in-memory run, NULL once stored on disk
+    struct rainbow_chain *chains;
+    off_t offset;
+    uint64_t count;
+    // runs of level n are merged from runs of level n - 1
+    unsigned int level;
+    // merge consuming the run, 0 if none
+    unsigned int merging;
+    // file holding the run, unused with a single run file
+    char name[64];
+};
+
+// space of released runs in the run file
+struct free_range {
+    off_t offset;
+    off_t size;
+};
+
+struct run_store {
+    struct run_store_config config;
+
+    // single run file, -1 when every run has its own file
+    int runFile;
+    char runFileName[64];
+
+    // protects everything below
+    pthread_mutex_t lock;
+    // signalled when runs are added or the merger is stopped
+    pthread_cond_t cond;
+    pthread_t merger;
+    int mergerStarted;
+    int stop;
+    // set while in-memory runs are merged to disk, other adders wait for
+    // the memory instead of spilling the same runs again
+    int spilling;
+
+    // end of the run file, new runs are appended there unless they fit
+    // into a free range
+    off_t runFileEnd;
+    // free ranges sorted by offset, adjacent ranges are joined
+    struct free_range *freeRanges;
+    unsigned int numFreeRanges;
+    unsigned int maxFreeRanges;
+
+    struct stored_run *runs;
+    unsigned int numRuns;
+    unsigned int maxRuns;
+    unsigned int numMerges;
+    uint64_t memoryUsed;
+};
+
+static struct stored_run *newRun(struct run_store *store)
+{
+    if (store->numRuns == store->maxRuns) {
+        store->maxRuns = store->maxRuns ? 2 * store->maxRuns : 64;
+        store->runs = realloc(store->runs,
+                              store->maxRuns * sizeof(*store->runs));
+        assert(store->runs);
+    }
+
+    return memset(&store->runs[store->numRuns++], 0,
+                  sizeof(*store->runs));
+}
+
+static int createFile(const char *name)
+{
+    int fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) {
+        perror("Error opening file");
+        exit(1);
+    }
+
+    return fd;
+}
+
+// returns space of a released run to the free ranges; called with the lock
+// held
+static void freeRange(struct run_store *store, off_t offset, off_t size)
+{
+    struct free_range *ranges;
+    unsigned int i, n;
+
+    if (store->numFreeRanges == store->maxFreeRanges) {
+        store->maxFreeRanges = store->maxFreeRanges
+                               ? 2 * store->maxFreeRanges : 16;
+        store->freeRanges = realloc(store->freeRanges, store->maxFreeRanges
+                                    * sizeof(*store->freeRanges));
+        assert(store->freeRanges);
+    }
+    ranges = store->freeRanges;
+    n = store->numFreeRanges;
+
+    for (i = 0; i < n && ranges[i].offset < offset; ++i)
+        ;
+    memmove(&ranges[i + 1], &ranges[i], (n - i) * sizeof(*ranges));
+    ranges[i].offset = offset;
+    ranges[i].size = size;
+    ++n;
+
+    // join with the following and the preceding range
+    if (i + 1 < n
+        && ranges[i].offset + ranges[i].size == ranges[i + 1].offset) {
+        ranges[i].size += ranges[i + 1].size;
+        memmove(&ranges[i + 1], &ranges[i + 2], (n - i - 2) * sizeof(*ranges));
+        --n;
+    }
+    if (i > 0
+        && ranges[i - 1].offset + ranges[i - 1].size == ranges[i].offset) {
+        ranges[i - 1].size += ranges[i].size;
+        memmove(&ranges[i], &ranges[i + 1], (n - i - 1) * sizeof(*ranges));
+        --n;
+    }
+
+    // space at the end of the file goes back to the file
+    if (n && ranges[n - 1].offset + ranges[n - 1].size == store->runFileEnd) {
+        store->runFileEnd = ranges[n - 1].offset;
+        --n;
+    }
+
+    store->numFreeRanges = n;
+}
+
+// reserves room for a run in the run file, in the first free range that
+// fits or at the end; the room is allocated on disk right away, so that
+// a full disk fails here rather than in the middle of a merge, and so that
+// punched holes get their blocks back; called with the lock held
+static off_t allocateRun(struct run_store *store, off_t size)
+{
+    struct free_range *range = NULL;
+    off_t offset;
+    unsigned int i;
+    int ret;
+
+    for (i = 0; i < store->numFreeRanges; ++i) {
+        if (store->freeRanges[i].size >= size) {
+            range = &store->freeRanges[i];
+            break;
+        }
+    }
+
+    if (range) {
+        offset = range->offset;
+        range->offset += size;
+        range->size -= size;
+        if (!range->size) {
+            memmove(range, range + 1, (store->numFreeRanges - i - 1)
+                                      * sizeof(*range));
+            --store->numFreeRanges;
+        }
+    } else {
+        offset = store->runFileEnd;
+        store->runFileEnd += size;
+    }
+
+    ret = size ? posix_fallocate(store->runFile, offset, size) : 0;
+    if (ret) {
+        fprintf(stderr, "Error allocating %lu MiB of %s: %s\n",
+                (unsigned long)(size >> 20), store->runFileName,
+                strerror(ret));
+        exit(1);
+    }
+
+    return offset;
+}
+
+// frees storage of a merged run
+static void releaseRun(struct run_store *store, struct stored_run *run)
+{
+    if (run->chains) {
+        store->memoryUsed -= run->count * sizeof(*run->chains);
+        free(run->chains);
+        run->chains = NULL;
+        return;
+    }
+
+    if (store->runFile < 0) {
+        unlink(run->name);
+        return;
+    }
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+    // best effort, the space is reclaimed with the run file anyway
+    fallocate(store->runFile, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+              run->offset, run->count * sizeof(struct rainbow_chain));
+#endif
+    freeRange(store, run->offset, run->count * sizeof(struct rainbow_chain));
+}
+
+// opens count runs for merging
+static struct chain_run *openRuns(struct run_store *store,
+                                  const struct stored_run *inputs,
+                                  unsigned int count)
+{
+    struct chain_run *runs;
+    unsigned int i;
+
+    runs = malloc(count * sizeof(*runs));
+    assert(runs);
+
+    for (i = 0; i < count; ++i) {
+        const struct stored_run *run = &inputs[i];
+
+        runs[i].chains = run->chains;
+        runs[i].offset = run->offset;
+        runs[i].count = run->count;
+        if (run->chains) {
+            runs[i].fd = -1;
+        } else if (store->runFile >= 0) {
+            runs[i].fd = store->runFile;
+        } else {
+            runs[i].fd = open(run->name, O_RDONLY);
+            if (runs[i].fd < 0) {
+                perror("Error opening run");
+                exit(1);
+            }
+        }
+    }
+
+    return runs;
+}
+
+static void closeRuns(struct run_store *store, struct chain_run *runs,
+                      unsigned int count)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; ++i) {
+        if (!runs[i].chains && store->runFile < 0)
+            close(runs[i].fd);
+    }
+    free(runs);
+}
+
+// merges count runs into fd at offset
+static void mergeGroup(struct run_store *store,
+                       const struct stored_run *inputs, unsigned int count,
+                       int fd, off_t offset)
+{
+    struct chain_writer writer;
+    struct chain_run *runs;
+
+    runs = openRuns(store, inputs, count);
+
+    chainWriterInit(&writer, fd, offset, store->config.writeBuffer);
+    mergeRuns(runs, count, &writer, store->config.readBuffer);
+    chainWriterClose(&writer);
+
+    closeRuns(store, runs, count);
+}
+
+// marks runs at given indices as inputs of a new merge, copies them to
+// inputs and prepares the output run; called with the lock held
+static unsigned int startMerge(struct run_store *store,
+                               const unsigned int *indices, unsigned int count,
+                               struct stored_run *inputs,
+                               struct stored_run *output, unsigned int level)
+{
+    unsigned int job = ++store->numMerges;
+    uint64_t total = 0;
+    unsigned int i;
+
+    for (i = 0; i < count; ++i) {
+        store->runs[indices[i]].merging = job;
+        inputs[i] = store->runs[indices[i]];
+        total += inputs[i].count;
+    }
+
+    memset(output, 0, sizeof(*output));
+    output->count = total;
+    output->level = level;
+
+    if (store->runFile >= 0) {
+        output->offset = allocateRun(store,
+                                     total * sizeof(struct rainbow_chain));
+    } else {
+        sprintf(output->name, "rainbow-len%u-m%03u.tmp",
+                store->config.passwordLength, job);
+    }
+
+    return job;
+}
+
+// writes merge prepared by startMerge() to its output run
+static void runMerge(struct run_store *store, const struct stored_run *inputs,
+                     unsigned int count, const struct stored_run *output)
+{
+    int fd = store->runFile;
+
+    if (fd < 0)
+        fd = createFile(output->name);
+
+    mergeGroup(store, inputs, count, fd, output->offset);
+
+    if (store->runFile < 0)
+        close(fd);
+}
+
+// replaces inputs of a finished merge by its output; called with the lock
+// held
+static void finishMerge(struct run_store *store, unsigned int job,
+                        const struct stored_run *output)
+{
+    unsigned int i, j = 0;
+
+    for (i = 0; i < store->numRuns; ++i) {
+        if (store->runs[i].merging == job)
+            releaseRun(store, &store->runs[i]);
+        else
+            store->runs[j++] = store->runs[i];
+    }
+    store->numRuns = j;
+
+    *newRun(store) = *output;
+    pthread_cond_broadcast(&store->cond);
+}
+
+// merges runs at given indices into a new run of given level; called with
+// the lock held, which is dropped while merging
+static void mergeToRun(struct run_store *store, const unsigned int *indices,
+                       unsigned int count, unsigned int level)
+{
+    struct stored_run *inputs;
+    struct stored_run output;
+    unsigned int job;
+
+    inputs = malloc(count * sizeof(*inputs));
+    assert(inputs);
+
+    job = startMerge(store, indices, count, inputs, &output, level);
+
+    pthread_mutex_unlock(&store->lock);
+    runMerge(store, inputs, count, &output);
+    pthread_mutex_lock(&store->lock);
+
+    finishMerge(store, job, &output);
+    free(inputs);
+}
+
+// finds factor runs on disk of the lowest level having that many; called
+// with the lock held
+static int findLevelGroup(struct run_store *store, unsigned int *indices,
+                          unsigned int factor, unsigned int *level)
+{
+    unsigned int counts[MAX_LEVELS] = { 0 };
+    unsigned int i, n = 0;
+
+    for (i = 0; i < store->numRuns; ++i) {
+        const struct stored_run *run = &store->runs[i];
+
+        if (!run->chains && !run->merging && run->level < MAX_LEVELS)
+            ++counts[run->level];
+    }
+
+    for (*level = 0; *level < MAX_LEVELS; ++*level) {
+        if (counts[*level] >= factor)
+            break;
+    }
+    if (*level == MAX_LEVELS)
+        return 0;
+
+    for (i = 0; i < store->numRuns && n < factor; ++i) {
+        const struct stored_run *run = &store->runs[i];
+
+        if (!run->chains && !run->merging && run->level == *level)
+            indices[n++] = i;
+    }
+
+    return 1;
+}
+
+// merges runs stored on disk while blocks are still being generated,
+// LSM-style: every mergeFactor runs of a level become one run of the next
+static void *mergerThread(void *data)
+{
+    struct run_store *store = data;
+    unsigned int factor = store->config.mergeFactor;
+    unsigned int *indices;
+    unsigned int level;
+
+    indices = malloc(factor * sizeof(*indices));
+    assert(indices);
+
+    pthread_mutex_lock(&store->lock);
+    while (!store->stop) {
+        if (findLevelGroup(store, indices, factor, &level)) {
+            printf("Merging %u runs of level %u in background...\n",
+                   factor, level);
+            mergeToRun(store, indices, factor, level + 1);
+        } else {
+            pthread_cond_wait(&store->cond, &store->lock);
+        }
+    }
+    pthread_mutex_unlock(&store->lock);
+
+    free(indices);
+
+    return NULL;
+}
+
+struct run_store *runStoreCreate(const struct run_store_config *config)
+{
+    struct run_store *store;
+    int ret;
+
+    store = calloc(1, sizeof(*store));
+    assert(store);
+
+    store->config = *config;
+    if (store->config.fanIn < 2)
+        store->config.fanIn = 2;
+    if (store->config.mergeFactor > store->config.fanIn)
+        store->config.mergeFactor = store->config.fanIn;
+    store->runFile = -1;
+
+    pthread_mutex_init(&store->lock, NULL);
+    pthread_cond_init(&store->cond, NULL);
+
+    if (config->singleFile) {
+        off_t size = (off_t)config->numberOfBlocks * config->chainsInBlock
+                            * sizeof(struct rainbow_chain);
+
+        sprintf(store->runFileName, "rainbow-len%u-runs.tmp",
+                config->passwordLength);
+        store->runFile = createFile(store->runFileName);
+
+        // fail now rather than after hours of generation if disk is full
+        ret = posix_fallocate(store->runFile, 0, size);
+        if (ret) {
+            fprintf(stderr, "Error preallocating %s: %s\n",
+                    store->runFileName, strerror(ret));
+            exit(1);
+        }
+    }
+
+    if (store->config.mergeFactor >= 2) {
+        ret = pthread_create(&store->merger, NULL, mergerThread, store);
+        assert(ret == 0);
+        store->mergerStarted = 1;
+    }
+
+    return store;
+}
+
+// waits for the merge in progress and stops the merger
+static void stopMerger(struct run_store *store)
+{
+    if (!store->mergerStarted)
+        return;
+
+    pthread_mutex_lock(&store->lock);
+    store->stop = 1;
+    pthread_cond_broadcast(&store->cond);
+    pthread_mutex_unlock(&store->lock);
+
+    pthread_join(store->merger, NULL);
+    store->mergerStarted = 0;
+}
+
+void runStoreDestroy(struct run_store *store)
+{
+    stopMerger(store);
+
+    if (store->runFile >= 0) {
+        close(store->runFile);
+        unlink(store->runFileName);
+    }
+
+    pthread_cond_destroy(&store->cond);
+    pthread_mutex_destroy(&store->lock);
+
+    free(store->freeRanges);
+    free(store->runs);
+    free(store);
+}
+
+// merges all in-memory runs into one run on disk to free the memory;
+// called with the lock held
+static void spill(struct run_store *store)
+{
+    unsigned int *indices;
+    unsigned int i, count = 0;
+
+    indices = malloc(store->numRuns * sizeof(*indices));
+    assert(indices);
+
+    for (i = 0; i < store->numRuns; ++i) {
+        if (store->runs[i].chains && !store->runs[i].merging)
+            indices[count++] = i;
+    }
+
+    if (count) {
+        printf("Spilling %u in-memory runs to disk...\n", count);
+        store->spilling = 1;
+        mergeToRun(store, indices, count, 0);
+        store->spilling = 0;
+        pthread_cond_broadcast(&store->cond);
+    }
+
+    free(indices);
+}
+
+void runStoreAdd(struct run_store *store, uint32_t blockNumber,
+                 const struct rainbow_chain *chains, size_t count)
+{
+    uint64_t size = count * sizeof(*chains);
+    struct stored_run run;
+    int fd;
+
+    memset(&run, 0, sizeof(run));
+    run.count = count;
+
+    pthread_mutex_lock(&store->lock);
+
+    if (store->config.memoryBudget) {
+        while (store->spilling)
+            pthread_cond_wait(&store->cond, &store->lock);
+
+        if (store->memoryUsed + size > store->config.memoryBudget)
+            spill(store);
+
+        if (size <= store->config.memoryBudget) {
+            run.chains = malloc(size);
+            assert(run.chains);
+            memcpy(run.chains, chains, size);
+            store->memoryUsed += size;
+            *newRun(store) = run;
+            pthread_mutex_unlock(&store->lock);
+            return;
+        }
+    }
+
+    if (store->runFile >= 0)
+        run.offset = allocateRun(store, size);
+    pthread_mutex_unlock(&store->lock);
+
+    if (store->runFile >= 0) {
+        chainsWrite(store->runFile, chains, count, run.offset);
+    } else {
+        sprintf(run.name, "rainbow-len%u-%03u.tmp",
+                store->config.passwordLength, blockNumber);
+        fd = createFile(run.name);
+        chainsWrite(fd, chains, count, 0);
+        close(fd);
+    }
+
+    pthread_mutex_lock(&store->lock);
+    *newRun(store) = run;
+    pthread_cond_broadcast(&store->cond);
+    pthread_mutex_unlock(&store->lock);
+}
+
+void runStoreMerge(struct run_store *store, const char *path, off_t offset)
+{
+    unsigned int fanIn = store->config.fanIn;
+    struct chain_run *runs;
+    unsigned int *indices;
+    unsigned int count, i;
+    uint64_t total = 0;
+    int out, ret;
+
+    stopMerger(store);
+
+    indices = malloc(fanIn * sizeof(*indices));
+    assert(indices);
+
+    pthread_mutex_lock(&store->lock);
+
+    // first group is sized so that every later merge, including the
+    // final one, takes exactly fanIn runs; merged runs are appended, so
+    // taking runs from the front merges them in FIFO order
+    if (store->numRuns > fanIn) {
+        printf("Merging %u runs in multiple passes...\n", store->numRuns);
+        count = (store->numRuns - 2) % (fanIn - 1) + 2;
+        for (;;) {
+            for (i = 0; i < count; ++i)
+                indices[i] = i;
+            mergeToRun(store, indices, count, 0);
+            if (store->numRuns <= fanIn)
+                break;
+            count = fanIn;
+        }
+    }
+
+    out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        perror("Error opening table");
+        exit(1);
+    }
+
+    for (i = 0; i < store->numRuns; ++i)
+        total += store->runs[i].count;
+
+    // ranges of the final merge are written in parallel at their offsets
+    ret = posix_fallocate(out, offset, total * sizeof(struct rainbow_chain));
+    if (ret) {
+        fprintf(stderr, "Error preallocating %s: %s\n", path, strerror(ret));
+        exit(1);
+    }
+
+    runs = openRuns(store, store->runs, store->numRuns);
+    mergeRunsParallel(store->config.pool, runs, store->numRuns, out, offset,
+                      store->config.readBuffer, store->config.writeBuffer);
+    closeRuns(store, runs, store->numRuns);
+    close(out);
+
+    for (i = 0; i < store->numRuns; ++i)
+        releaseRun(store, &store->runs[i]);
+    store->numRuns = 0;
+
+    pthread_mutex_unlock(&store->lock);
+    free(indices);
+}
+
+unsigned int runStoreDefaultFanIn(void)
+{
+    struct rlimit limit;
+    rlim_t fanIn = MAX_DEFAULT_FAN_IN;
+
+    if (!getrlimit(RLIMIT_NOFILE, &limit) && limit.rlim_cur != RLIM_INFINITY
+        && limit.rlim_cur < fanIn + RESERVED_FDS)
+        fanIn = limit.rlim_cur > RESERVED_FDS + 2
+                    ? limit.rlim_cur - RESERVED_FDS : 2;
+
+    return fanIn;
+}
@@ -0,0 +1,51 @@
+#ifndef _RUN_STORE_H
+#define _RUN_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "rainbow_chain.h"
+#include "thread_pool.h"
+
+struct run_store_config {
+    uint32_t passwordLength;
+    uint32_t numberOfBlocks;
+    uint32_t chainsInBlock;
+    // keep all runs in one preallocated file instead of a file per run
+    int singleFile;
+    // bytes of sorted runs kept in memory before spilling them to disk,
+    // 0 stores every run on disk
+    uint64_t memoryBudget;
+    // maximum number of runs merged at once
+    unsigned int fanIn;
+    // merge every mergeFactor runs of the same level into a run of the
+    // next level in a background thread, 0 merges only at the end
+    unsigned int mergeFactor;
+    // read-ahead buffer of every merged run and output buffer, in bytes
+    size_t readBuffer;
+    size_t writeBuffer;
+    // threads of the final merge, NULL merges in the calling thread
+    struct thread_pool *pool;
+};
+
+// sorted runs waiting to be merged into the final table
+struct run_store;
+
+struct run_store *runStoreCreate(const struct run_store_config *config);
+void runStoreDestroy(struct run_store *store);
+
+// stores sorted block as a new run, in memory while within the budget;
+// may be called from several threads
+void runStoreAdd(struct run_store *store, uint32_t blockNumber,
+                 const struct rainbow_chain *chains, size_t count);
+
+// waits for background merges, then merges all runs into the file at path,
+// starting at byte offset, and removes them; runs exceeding the fan-in are
+// first merged in additional passes
+void runStoreMerge(struct run_store *store, const char *path, off_t offset);
+
+// fan-in leaving enough file descriptors below RLIMIT_NOFILE
+unsigned int runStoreDefaultFanIn(void);
+
+#endif
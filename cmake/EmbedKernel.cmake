@@ -0,0 +1,34 @@
+# Embeds an OpenCL kernel source into a C file, run with cmake -P
+#
+#  SOURCE       - kernel source file
+#  INCLUDE_DIR  - directory of files included by the kernel with #include "..."
+#  OUTPUT       - generated C file
+#  NAME         - symbol prefix, the file defines NAMESource and NAMESize
+#
+# Included files are inlined, so that the program can be built from
+# the embedded string without files in the working directory.
+
+file(READ ${SOURCE} source)
+
+string(REGEX MATCHALL "#include \"[^\"]+\"" includes "${source}")
+foreach(include ${includes})
+	string(REGEX REPLACE "#include \"([^\"]+)\"" "\\1" path "${include}")
+	file(READ ${INCLUDE_DIR}/${path} content)
+	string(REPLACE "${include}" "${content}" source "${source}")
+endforeach()
+
+# bytes as a hex array, which avoids escaping the source in a string literal
+file(WRITE ${OUTPUT}.tmp "${source}")
+file(READ ${OUTPUT}.tmp hex HEX)
+file(REMOVE ${OUTPUT}.tmp)
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," hex "${hex}")
+string(REGEX REPLACE "(0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,)" "\\1\n    " hex "${hex}")
+
+file(WRITE ${OUTPUT}
+"// generated from ${SOURCE}, do not edit\n"
+"#include <stddef.h>\n"
+"\n"
+"const char ${NAME}Source[] = {\n"
+"    ${hex}0x00\n"
+"};\n"
+"const size_t ${NAME}Size = sizeof(${NAME}Source) - 1;\n")
@@ -28,6 +28,24 @@
 
 #define DATA_LOC
 
+// Host builds the program with -DPASSWORD_LENGTH=n -DCHAIN_LENGTH=t, so that
+// reduce() and md5() compile to straight-line code with constant padding
+// and length words. Without them, values passed in struct args are used.
+#ifdef PASSWORD_LENGTH
+#define PASSWORD_LEN(args)      (PASSWORD_LENGTH)
+#else
+#define PASSWORD_LEN(args)      ((args).passwordLength)
+#endif
+
+#ifdef CHAIN_LENGTH
+#define CHAIN_LEN(args)         (CHAIN_LENGTH)
+#else
+#define CHAIN_LEN(args)         ((args).chainLength)
+#endif
+
+// number of message words a password with its 0x80 terminator can touch
+#define MSG_WORDS               (MAX_PASSWD / 4 + 1)
+
 #define REDUCTION_TABLE_SIZE    512
 __constant const char reductionMap[REDUCTION_TABLE_SIZE] =
                                     "bKeixL,OfX.IyFAoPVafpxZtjXBRzG7w"
@@ -49,33 +67,36 @@ __constant const char reductionMap[REDUCTION_TABLE_SIZE] =
 
 inline void reduce(DATA_LOC DATA_TYPE *data, uint length, uint salt)
 {
-    uint i;
+    DATA_TYPE hash[4];
+    uint p;
 
-    for (i = 0; i < (length + 2) / 3; ++i) {
-        DATA_TYPE word = data[i] + salt;
-        uint j;
+    for (p = 0; p < 4; ++p)
+        hash[p] = data[p];
 
-        data[i] = (DATA_TYPE)(0);
+    for (p = 0; p < MSG_WORDS; ++p)
+        data[p] = (DATA_TYPE)(0);
 
-        for (j = 0; j < 3 && 3 * i + j < length; ++j) {
-            DATA_TYPE index = word % REDUCTION_TABLE_SIZE;
+    // with PASSWORD_LENGTH defined this unrolls to straight-line code
+#pragma unroll
+    for (p = 0; p < length; ++p) {
+        uint i = p / 3;
+        // see REDUCTION_WORD() in Lib/utils.h
+        DATA_TYPE word = (i < 4 ? hash[i] : hash[i & 3] ^ hash[(i + 1) & 3])
+                         + salt;
+        DATA_TYPE index = (word >> ((p % 3) * 9)) % REDUCTION_TABLE_SIZE;
 #ifdef USE_VECTORS
-            DATA_TYPE byte = (DATA_TYPE)(reductionMap[index.x],
-                                 reductionMap[index.y],
-                                 reductionMap[index.z],
-                                 reductionMap[index.w]);
+        DATA_TYPE byte = (DATA_TYPE)(reductionMap[index.x],
+                             reductionMap[index.y],
+                             reductionMap[index.z],
+                             reductionMap[index.w]);
 #else
-            DATA_TYPE byte = reductionMap[index];
+        DATA_TYPE byte = reductionMap[index];
 #endif
-            PUTCHAR(data, 3 * i + j, byte);
-            word /= REDUCTION_TABLE_SIZE;
-        }
+        // the word was cleared above, no need to mask it
+        data[p >> 2] |= byte << ((p & 3) << 3);
     }
 
-    for (; i < 4; ++i)
-        data[i] = (DATA_TYPE)(0);
-
-    PUTCHAR(data, length, 0x80);
+    data[length >> 2] |= (DATA_TYPE)(0x80) << ((length & 3) << 3);
 }
 
 // calculates MD5 hashes of 4 input passwords at a time
@@ -94,7 +115,7 @@ inline void md5(DATA_LOC DATA_TYPE *keys, uint passwordLength)
     STEP(F, d, a, b, c, keys[1],        0xe8c7b756, 12)
     STEP(F, c, d, a, b, keys[2],        0x242070db, 17)
     STEP(F, b, c, d, a, keys[3],        0xc1bdceee, 22)
-    STEP(F, a, b, c, d, (DATA_TYPE)(0), 0xf57c0faf, 7)
+    STEP(F, a, b, c, d, keys[4],        0xf57c0faf, 7)
     STEP(F, d, a, b, c, (DATA_TYPE)(0), 0x4787c62a, 12)
     STEP(F, c, d, a, b, (DATA_TYPE)(0), 0xa8304613, 17)
     STEP(F, b, c, d, a, (DATA_TYPE)(0), 0xfd469501, 22)
@@ -115,7 +136,7 @@ inline void md5(DATA_LOC DATA_TYPE *keys, uint passwordLength)
     STEP(G, a, b, c, d, (DATA_TYPE)(0), 0xd62f105d, 5)
     STEP(G, d, a, b, c, (DATA_TYPE)(0), 0x02441453, 9)
     STEP(G, c, d, a, b, (DATA_TYPE)(0), 0xd8a1e681, 14)
-    STEP(G, b, c, d, a, (DATA_TYPE)(0), 0xe7d3fbc8, 20)
+    STEP(G, b, c, d, a, keys[4],        0xe7d3fbc8, 20)
     STEP(G, a, b, c, d, (DATA_TYPE)(0), 0x21e1cde6, 5)
     STEP(G, d, a, b, c, len,            0xc33707d6, 9)
     STEP(G, c, d, a, b, keys[3],        0xf4d50d87, 14)
@@ -131,7 +152,7 @@ inline void md5(DATA_LOC DATA_TYPE *keys, uint passwordLength)
     STEP(H, c, d, a, b, (DATA_TYPE)(0), 0x6d9d6122, 16)
     STEP(H, b, c, d, a, len,            0xfde5380c, 23)
     STEP(H, a, b, c, d, keys[1],        0xa4beea44, 4)
-    STEP(H, d, a, b, c, (DATA_TYPE)(0), 0x4bdecfa9, 11)
+    STEP(H, d, a, b, c, keys[4],        0x4bdecfa9, 11)
     STEP(H, c, d, a, b, (DATA_TYPE)(0), 0xf6bb4b60, 16)
     STEP(H, b, c, d, a, (DATA_TYPE)(0), 0xbebfbc70, 23)
     STEP(H, a, b, c, d, (DATA_TYPE)(0), 0x289b7ec6, 4)
@@ -156,7 +177,7 @@ inline void md5(DATA_LOC DATA_TYPE *keys, uint passwordLength)
     STEP(I, d, a, b, c, (DATA_TYPE)(0), 0xfe2ce6e0, 10)
     STEP(I, c, d, a, b, (DATA_TYPE)(0), 0xa3014314, 15)
     STEP(I, b, c, d, a, (DATA_TYPE)(0), 0x4e0811a1, 21)
-    STEP(I, a, b, c, d, (DATA_TYPE)(0), 0xf7537e82, 6)
+    STEP(I, a, b, c, d, keys[4],        0xf7537e82, 6)
     STEP(I, d, a, b, c, (DATA_TYPE)(0), 0xbd3af235, 10)
     STEP(I, c, d, a, b, keys[2],        0x2ad7d2bb, 15)
     STEP(I, b, c, d, a, (DATA_TYPE)(0), 0xeb86d391, 21)
@@ -175,13 +196,50 @@ struct args {
     uint showDist;
 };
 
+// stores hashes in buf as hashes of work-item id
+inline void storeHashes(DATA_LOC DATA_TYPE *buf, __global uint *hashes,
+                        uint id)
+{
+    uint i;
+
+    for (i = 0; i < 4; ++i) {
+#ifdef USE_VECTORS
+        hashes[(4 * id + 0) * 4 + i] = buf[i].x;
+        hashes[(4 * id + 1) * 4 + i] = buf[i].y;
+        hashes[(4 * id + 2) * 4 + i] = buf[i].z;
+        hashes[(4 * id + 3) * 4 + i] = buf[i].w;
+#else
+        hashes[id * 4 + i] = buf[i];
+#endif
+    }
+}
+
+// walks chains of start passwords in buf and stores their end-point hashes
+inline void walkChains(DATA_LOC DATA_TYPE *buf, __global uint *hashes,
+                       struct args args, uint id)
+{
+    const uint len = PASSWORD_LEN(args);
+    uint i;
+
+    PUTCHAR(buf, len, 0x80);
+
+    for (i = 0; i < CHAIN_LEN(args); ++i) {
+        md5(buf, len);
+        reduce(buf, len, i);
+    }
+    md5(buf, len);
+
+    storeHashes(buf, hashes, id);
+}
+
 __kernel void rainbow(__global uint *hashes, __constant uint *passwords,
                       struct args args)
 {
     uint id = get_global_id(0);
-    DATA_LOC DATA_TYPE buf[MAX_PASSWD / 4];
-    uint len = args.passwordLength;
-    int i;
+    DATA_LOC DATA_TYPE buf[MSG_WORDS];
+    uint i;
+
+    buf[MAX_PASSWD / 4] = (DATA_TYPE)(0);
 
     for (i = 0; i < MAX_PASSWD / 4; ++i) {
 #ifdef USE_VECTORS
@@ -194,22 +252,135 @@ __kernel void rainbow(__global uint *hashes, __constant uint *passwords,
 #endif
     }
 
-    PUTCHAR(buf, len, 0x80);
+    walkChains(buf, hashes, args, id);
+}
 
-    for (i = 0; i < args.chainLength; ++i) {
-        md5(buf, len);
-        reduce(buf, len, i);
+// Philox4x32-10 counter-based generator, the same as philox() in Lib/philox.h
+#define PHILOX_M0               0xD2511F53U
+#define PHILOX_M1               0xCD9E8D57U
+#define PHILOX_W0               0x9E3779B9U
+#define PHILOX_W1               0xBB67AE85U
+#define PHILOX_ROUNDS           10
+
+__constant const char charset[64] = "0123456789,."
+                                    "abcdefghijklmnopqrstuvwxyz"
+                                    "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+// writes start password of chain index into message words, the same as
+// philoxPassword() in Lib/philox.h
+inline void startPassword(uint *words, uint length, ulong seed, ulong index)
+{
+    uint ctr[4] = { (uint)index, (uint)(index >> 32), 0, 0 };
+    uint k0 = (uint)seed;
+    uint k1 = (uint)(seed >> 32);
+    uint i, p;
+
+    for (i = 0; i < PHILOX_ROUNDS; ++i) {
+        uint hi0 = mul_hi(PHILOX_M0, ctr[0]);
+        uint lo0 = PHILOX_M0 * ctr[0];
+        uint hi1 = mul_hi(PHILOX_M1, ctr[2]);
+        uint lo1 = PHILOX_M1 * ctr[2];
+
+        ctr[0] = hi1 ^ ctr[1] ^ k0;
+        ctr[1] = lo1;
+        ctr[2] = hi0 ^ ctr[3] ^ k1;
+        ctr[3] = lo0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
     }
-    md5(buf, len);
 
-    for (i = 0; i < 4; ++i) {
+    for (p = 0; p < MSG_WORDS; ++p)
+        words[p] = 0;
+
+#pragma unroll
+    for (p = 0; p < length; ++p) {
+        uint c = charset[(ctr[p / 5] >> ((p % 5) * 6)) & 63];
+
+        words[p >> 2] |= c << ((p & 3) << 3);
+    }
+}
+
+// generates chains with start passwords derived from seed and chain index,
+// block starts with chain firstChain; no passwords are uploaded
+__kernel void rainbow_philox(__global uint *hashes, struct args args,
+                             ulong seed, ulong firstChain)
+{
+    uint id = get_global_id(0);
+    DATA_LOC DATA_TYPE buf[MSG_WORDS];
+    const uint len = PASSWORD_LEN(args);
 #ifdef USE_VECTORS
-        hashes[(4 * id + 0) * 4 + i] = buf[i].x;
-        hashes[(4 * id + 1) * 4 + i] = buf[i].y;
-        hashes[(4 * id + 2) * 4 + i] = buf[i].z;
-        hashes[(4 * id + 3) * 4 + i] = buf[i].w;
+    uint lanes[4][MSG_WORDS];
+    uint i;
+
+    for (i = 0; i < 4; ++i)
+        startPassword(lanes[i], len, seed, firstChain + 4 * id + i);
+
+    for (i = 0; i < MSG_WORDS; ++i)
+        buf[i] = (uint4)(lanes[0][i], lanes[1][i], lanes[2][i], lanes[3][i]);
 #else
-        hashes[id * 4 + i] = buf[i];
+    startPassword(buf, len, seed, firstChain + id);
 #endif
+
+    walkChains(buf, hashes, args, id);
+}
+
+#ifdef USE_VECTORS
+#define LANES                   4
+#else
+#define LANES                   1
+#endif
+
+// walks target hashes of the cracker to chain end-points; pair p is target
+// p / numPositions at chain position firstPosition + p % numPositions, where
+// position i is the hash i links before the end of a chain
+__kernel void rainbow_endpoints(__global uint *endPoints,
+                                __constant uint *targets, struct args args,
+                                uint firstPosition, uint numPositions,
+                                uint numPairs)
+{
+    uint id = get_global_id(0);
+    DATA_LOC DATA_TYPE buf[MSG_WORDS];
+    DATA_TYPE hash[4];
+    DATA_TYPE firstSalt;
+    const uint len = PASSWORD_LEN(args);
+    uint words[LANES][4];
+    uint salts[LANES];
+    uint first = CHAIN_LEN(args);
+    uint i, l, s;
+
+    // pairs past the end repeat the last one, their results are not read
+    for (l = 0; l < LANES; ++l) {
+        uint p = min(LANES * id + l, numPairs - 1);
+        uint target = p / numPositions;
+
+        salts[l] = CHAIN_LEN(args) - (firstPosition + p % numPositions);
+        first = min(first, salts[l]);
+        for (i = 0; i < 4; ++i)
+            words[l][i] = targets[target * 4 + i];
     }
+
+#ifdef USE_VECTORS
+    firstSalt = (uint4)(salts[0], salts[1], salts[2], salts[3]);
+    for (i = 0; i < 4; ++i)
+        buf[i] = (uint4)(words[0][i], words[1][i], words[2][i], words[3][i]);
+#else
+    firstSalt = salts[0];
+    for (i = 0; i < 4; ++i)
+        buf[i] = words[0][i];
+#endif
+
+    // every lane ends at the last link, lanes whose position is not reached
+    // yet keep their hash
+    for (s = first; s < CHAIN_LEN(args); ++s) {
+        for (i = 0; i < 4; ++i)
+            hash[i] = buf[i];
+
+        reduce(buf, len, s);
+        md5(buf, len);
+
+        for (i = 0; i < 4; ++i)
+            buf[i] = select(hash[i], buf[i], firstSalt <= (DATA_TYPE)(s));
+    }
+
+    storeHashes(buf, endPoints, id);
 }
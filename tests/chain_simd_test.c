@@ -0,0 +1,139 @@
+// every chain_simd implementation the CPU supports has to agree with
+// reduce() and hash() for all password lengths, in generate and in walk
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chain_simd.h"
+#include "utils.h"
+
+// not a multiple of any lane count, so that padding lanes are exercised
+#define NUM_CHAINS              37
+#define CHAIN_LENGTH            50
+
+static const char *names[] = { "avx512", "avx2", "sse2", "scalar" };
+
+static uint64_t state = 0x2545F4914F6CDD1Dull;
+
+static uint32_t nextRandom(void)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+
+    return (uint32_t)state;
+}
+
+static void referenceChain(hash_t out, const password_t start, size_t length,
+                           uint32_t chainLength)
+{
+    password_t password;
+    uint32_t i;
+
+    memcpy(password, start, sizeof(password));
+    hash(out, password, length);
+    for (i = 0; i < chainLength; ++i) {
+        reduce(password, out, length, i);
+        hash(out, password, length);
+    }
+}
+
+static void referenceWalk(hash_t h, size_t length, uint32_t firstSalt,
+                          uint32_t steps)
+{
+    password_t password;
+    uint32_t i;
+
+    for (i = 0; i < steps; ++i) {
+        reduce(password, h, length, firstSalt + i);
+        hash(h, password, length);
+    }
+}
+
+static unsigned int testGenerate(const struct chain_simd *simd, size_t length)
+{
+    struct rainbow_chain chains[NUM_CHAINS];
+    hash_t expected;
+    unsigned int failed = 0;
+    size_t i, p;
+
+    memset(chains, 0, sizeof(chains));
+    for (i = 0; i < NUM_CHAINS; ++i) {
+        for (p = 0; p < length; ++p)
+            chains[i].password[p] = charset[nextRandom() % CHARSET_SIZE];
+    }
+
+    simd->generate[length](chains, NUM_CHAINS, CHAIN_LENGTH);
+
+    for (i = 0; i < NUM_CHAINS; ++i) {
+        referenceChain(expected, chains[i].password, length, CHAIN_LENGTH);
+        if (memcmp(chains[i].hash, expected, sizeof(hash_t))) {
+            fprintf(stderr, "%s generate, length %zu: chain %zu differs\n",
+                    simd->name, length, i);
+            ++failed;
+        }
+    }
+
+    return failed;
+}
+
+static unsigned int testWalk(const struct chain_simd *simd, size_t length)
+{
+    hash_t hashes[NUM_CHAINS];
+    hash_t expected[NUM_CHAINS];
+    uint32_t firstSalts[NUM_CHAINS];
+    uint32_t steps[NUM_CHAINS];
+    unsigned int failed = 0;
+    size_t i, p;
+
+    // lanes of a group take different numbers of steps, some none
+    for (i = 0; i < NUM_CHAINS; ++i) {
+        for (p = 0; p < 4; ++p)
+            hashes[i][p] = nextRandom();
+        firstSalts[i] = nextRandom() % CHAIN_LENGTH;
+        steps[i] = nextRandom() % (CHAIN_LENGTH - firstSalts[i] + 1);
+
+        memcpy(expected[i], hashes[i], sizeof(hash_t));
+        referenceWalk(expected[i], length, firstSalts[i], steps[i]);
+    }
+
+    simd->walk[length](hashes, firstSalts, steps, NUM_CHAINS);
+
+    for (i = 0; i < NUM_CHAINS; ++i) {
+        if (memcmp(hashes[i], expected[i], sizeof(hash_t))) {
+            fprintf(stderr, "%s walk, length %zu: hash %zu differs\n",
+                    simd->name, length, i);
+            ++failed;
+        }
+    }
+
+    return failed;
+}
+
+int main(void)
+{
+    unsigned int failed = 0;
+    unsigned int i;
+    size_t length;
+
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        const struct chain_simd *simd = chainSimdFind(names[i]);
+
+        if (!simd) {
+            printf("%s not supported, skipped\n", names[i]);
+            continue;
+        }
+
+        for (length = 1; length <= MAX_PASSWD; ++length) {
+            failed += testGenerate(simd, length);
+            failed += testWalk(simd, length);
+        }
+        printf("%s checked\n", simd->name);
+    }
+
+    if (failed)
+        return 1;
+
+    printf("chain simd test passed\n");
+    return 0;
+}
@@ -0,0 +1,61 @@
+// philox() against the Philox4x32-10 known-answer vectors of Random123
+// (kat_vectors)
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "philox.h"
+
+struct philox_kat {
+    uint32_t ctr[4];
+    uint32_t key[2];
+    uint32_t expected[4];
+};
+
+static const struct philox_kat kats[] = {
+    {
+        { 0x00000000, 0x00000000, 0x00000000, 0x00000000 },
+        { 0x00000000, 0x00000000 },
+        { 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 },
+    },
+    {
+        { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff },
+        { 0xffffffff, 0xffffffff },
+        { 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd },
+    },
+    {
+        { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 },
+        { 0xa4093822, 0x299f31d0 },
+        { 0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 },
+    },
+};
+
+int main(void)
+{
+    unsigned int failed = 0;
+    unsigned int i, j;
+
+    for (i = 0; i < sizeof(kats) / sizeof(kats[0]); ++i) {
+        const struct philox_kat *kat = &kats[i];
+        uint32_t ctr[4];
+
+        for (j = 0; j < 4; ++j)
+            ctr[j] = kat->ctr[j];
+
+        // the first key word is the low half of the 64-bit key
+        philox(ctr, kat->key[0] | (uint64_t)kat->key[1] << 32);
+
+        for (j = 0; j < 4; ++j) {
+            if (ctr[j] != kat->expected[j]) {
+                fprintf(stderr, "vector %u word %u: %08x, expected %08x\n",
+                        i, j, ctr[j], kat->expected[j]);
+                ++failed;
+            }
+        }
+    }
+
+    if (failed)
+        return 1;
+
+    printf("%u known-answer vectors passed\n", i);
+    return 0;
+}
@@ -0,0 +1,153 @@
+// several threads add blocks to a run store with a memory budget of a few
+// blocks, so that their spills overlap; the merged table must hold every
+// chain exactly once, in order
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "run_store.h"
+
+#define NUM_THREADS             4
+#define BLOCKS_PER_THREAD       16
+#define CHAINS_IN_BLOCK         4096
+#define TABLE_NAME              "run_store_test.tbl"
+
+static struct run_store *store;
+
+static int compareChains(const void *a, const void *b)
+{
+    uint64_t keyA = hashKey(((const struct rainbow_chain *)a)->hash);
+    uint64_t keyB = hashKey(((const struct rainbow_chain *)b)->hash);
+
+    return keyA < keyB ? -1 : keyA > keyB;
+}
+
+// hash words are a function of the chain number, so that the merged table
+// can be checked without keeping the input
+static void makeChain(struct rainbow_chain *chain, uint64_t number)
+{
+    uint64_t x = number * 0x9E3779B97F4A7C15ull;
+
+    x ^= x >> 31;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+
+    memset(chain, 0, sizeof(*chain));
+    memcpy(chain->hash, &x, sizeof(x));
+    memcpy(&chain->hash[2], &number, sizeof(number));
+}
+
+static void *adder(void *data)
+{
+    unsigned int thread = (unsigned int)(uintptr_t)data;
+    struct rainbow_chain *chains;
+    unsigned int b, i;
+
+    chains = malloc(CHAINS_IN_BLOCK * sizeof(*chains));
+    assert(chains);
+
+    for (b = 0; b < BLOCKS_PER_THREAD; ++b) {
+        uint32_t block = thread * BLOCKS_PER_THREAD + b;
+
+        for (i = 0; i < CHAINS_IN_BLOCK; ++i)
+            makeChain(&chains[i], (uint64_t)block * CHAINS_IN_BLOCK + i);
+        qsort(chains, CHAINS_IN_BLOCK, sizeof(*chains), compareChains);
+        runStoreAdd(store, block, chains, CHAINS_IN_BLOCK);
+    }
+
+    free(chains);
+    return NULL;
+}
+
+static void checkTable(uint64_t total)
+{
+    struct rainbow_chain *chains;
+    unsigned char *seen;
+    uint64_t i, number;
+    size_t read;
+    FILE *file;
+    int extra;
+
+    chains = malloc(total * sizeof(*chains));
+    assert(chains);
+    seen = calloc(total, 1);
+    assert(seen);
+
+    file = fopen(TABLE_NAME, "rb");
+    if (!file) {
+        perror("Error opening " TABLE_NAME);
+        exit(1);
+    }
+    read = fread(chains, sizeof(*chains), total, file);
+    extra = fgetc(file);
+    fclose(file);
+    if (read != total || extra != EOF) {
+        fprintf(stderr, "Table holds %lu chains%s, expected %lu\n",
+                (unsigned long)read, extra != EOF ? " and more" : "",
+                (unsigned long)total);
+        exit(1);
+    }
+
+    // checks stay outside assert(), so that they run with NDEBUG too
+    for (i = 0; i < total; ++i) {
+        if (i && compareChains(&chains[i - 1], &chains[i]) > 0) {
+            fprintf(stderr, "Chain %lu is out of order\n", (unsigned long)i);
+            exit(1);
+        }
+        memcpy(&number, &chains[i].hash[2], sizeof(number));
+        if (number >= total || seen[number]) {
+            fprintf(stderr, "Chain %lu is unknown or duplicated\n",
+                    (unsigned long)number);
+            exit(1);
+        }
+        seen[number] = 1;
+    }
+
+    free(seen);
+    free(chains);
+}
+
+static void runTest(int singleFile)
+{
+    struct run_store_config config;
+    pthread_t threads[NUM_THREADS];
+    unsigned int i;
+
+    memset(&config, 0, sizeof(config));
+    config.passwordLength = 5;
+    config.numberOfBlocks = NUM_THREADS * BLOCKS_PER_THREAD;
+    config.chainsInBlock = CHAINS_IN_BLOCK;
+    config.singleFile = singleFile;
+    config.memoryBudget = 3 * CHAINS_IN_BLOCK * sizeof(struct rainbow_chain);
+    config.fanIn = 8;
+    config.readBuffer = 64 << 10;
+    config.writeBuffer = 64 << 10;
+
+    store = runStoreCreate(&config);
+
+    for (i = 0; i < NUM_THREADS; ++i) {
+        if (pthread_create(&threads[i], NULL, adder, (void *)(uintptr_t)i)) {
+            fprintf(stderr, "Cannot create adder thread\n");
+            exit(1);
+        }
+    }
+    for (i = 0; i < NUM_THREADS; ++i)
+        pthread_join(threads[i], NULL);
+
+    runStoreMerge(store, TABLE_NAME, 0);
+    runStoreDestroy(store);
+
+    checkTable((uint64_t)config.numberOfBlocks * CHAINS_IN_BLOCK);
+    unlink(TABLE_NAME);
+}
+
+int main(void)
+{
+    runTest(0);
+    runTest(1);
+    printf("run store test passed\n");
+    return 0;
+}